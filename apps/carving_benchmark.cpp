@@ -0,0 +1,240 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <opencv2/imgproc.hpp>
+#include <Camera.h>
+#include <Reconstructor.h>
+#include <ForegroundOptimizer.h>
+#include <ReconstructionConfig.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using nl_uu_science_gmt::Camera;
+using nl_uu_science_gmt::CandidateOrder;
+using nl_uu_science_gmt::ForegroundOptimizer;
+using nl_uu_science_gmt::ReconstructionConfig;
+using nl_uu_science_gmt::Reconstructor;
+
+namespace
+{
+
+/**
+ * Hardware cache miss counter of the calling process, reads -1 when the
+ * kernel doesn't allow counting (see /proc/sys/kernel/perf_event_paranoid)
+ */
+class CacheCounter
+{
+    int m_fd = -1;
+
+public:
+    explicit CacheCounter(uint64_t cache)
+    {
+#ifdef __linux__
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.size = sizeof(attr);
+        attr.config = cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.inherit = 1;   // Include the OpenMP worker threads
+        m_fd = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+        (void) cache;
+#endif
+    }
+
+    ~CacheCounter()
+    {
+#ifdef __linux__
+        if (m_fd >= 0)
+            close(m_fd);
+#endif
+    }
+
+    CacheCounter(const CacheCounter&) = delete;
+    CacheCounter& operator=(const CacheCounter&) = delete;
+
+    void start()
+    {
+#ifdef __linux__
+        if (m_fd >= 0)
+        {
+            ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    int64_t stop()
+    {
+#ifdef __linux__
+        uint64_t count = 0;
+        if (m_fd >= 0)
+        {
+            ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(m_fd, &count, sizeof(count)) == sizeof(count))
+                return (int64_t) count;
+        }
+#endif
+        return -1;
+    }
+};
+
+#ifdef __linux__
+constexpr uint64_t L1D_CACHE = PERF_COUNT_HW_CACHE_L1D;
+constexpr uint64_t LAST_LEVEL_CACHE = PERF_COUNT_HW_CACHE_LL;
+#else
+constexpr uint64_t L1D_CACHE = 0;
+constexpr uint64_t LAST_LEVEL_CACHE = 0;
+#endif
+
+const char* getOrderName(CandidateOrder order)
+{
+    return order == CandidateOrder::Morton ? "Morton" : "Linear";
+}
+
+/**
+ * Measures how far the pinhole projection, looked up through the
+ * undistortion table, lands from the distorted projection for every
+ * candidate voxel: the largest deviation along x or y in pixels, and how
+ * many candidates deviate more than 1 pixel. Candidates outside either
+ * image are counted apart.
+ */
+void reportPinholeDeviation(const Reconstructor &reconstructor, const std::vector<Camera> &cameras)
+{
+    const size_t count = reconstructor.getCandidateCount();
+    const uint32_t* indices = reconstructor.getCandidateVoxelIndices();
+    std::vector<cv::Point3f> points(count);
+    for (size_t v = 0; v < count; ++v)
+        points[v] = reconstructor.getVoxelGrid().coordinate(indices[v]);
+
+    std::vector<cv::Point> distorted(count), pinhole(count);
+    for (size_t c = 0; c < cameras.size(); ++c)
+    {
+        const Camera& camera = cameras[c];
+        camera.projectOnView(points.data(), count, distorted.data());
+        camera.projectOnUndistortedView(points.data(), count, pinhole.data());
+
+        int max_deviation = 0;
+        size_t beyond = 0, outside = 0;
+        for (size_t v = 0; v < count; ++v)
+        {
+            cv::Point looked_up;
+            if (distorted[v].x < 0 || distorted[v].x >= camera.getSize().width || distorted[v].y < 0
+                    || distorted[v].y >= camera.getSize().height || !camera.getDistortedPixel(pinhole[v], looked_up))
+            {
+                ++outside;
+                continue;
+            }
+            const int deviation = std::max(std::abs(looked_up.x - distorted[v].x), std::abs(looked_up.y - distorted[v].y));
+            max_deviation = std::max(max_deviation, deviation);
+            if (deviation > 1)
+                ++beyond;
+        }
+        std::cout << "Pinhole projection, camera " << c << ": max deviation " << max_deviation << " px, "
+                << beyond << " of " << count - outside << " candidates beyond 1 px, " << outside
+                << " outside the image" << std::endl;
+    }
+}
+
+}
+
+/**
+ * Times dense carving of one frame with the candidates in linear and in
+ * Morton order, and counts the L1D and last level cache read misses. First
+ * reports how far the pinhole projection deviates from the distorted one.
+ * Usage: carving_benchmark [frame] [iterations]
+ */
+int main(int argc, char* argv[])
+{
+    const int frame = argc > 1 ? std::atoi(argv[1]) : 2 * 672;
+    const int iterations = argc > 2 ? std::max(1, std::atoi(argv[2])) : 100;
+    std::filesystem::path data_path = "../data";
+
+    ReconstructionConfig config;
+    if (config.load(data_path / "reconstruction.xml")) {
+        std::cout << "[carving_benchmark] Using " << data_path / "reconstruction.xml" << std::endl;
+    }
+
+    std::vector<Camera> cameras;
+    for (int i = 0; i < config.camera_count; ++i)
+    {
+        auto& camera = cameras.emplace_back(data_path / ("cam" + std::to_string(i + 1)), "config.xml", i);
+        if (!camera.initialize(config.seed_background ? "background.png" : "", "video.avi")) {
+            return EXIT_FAILURE;
+        }
+        camera.getVideoFrame(frame);
+        if (camera.getFrame().empty()) {
+            std::cerr << "[carving_benchmark] Error: frame " << frame << " is empty." << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        cv::Mat hsv_image;
+        cvtColor(camera.getFrame(), hsv_image, cv::COLOR_BGR2HSV);
+        std::vector<cv::Mat> channels;
+        cv::split(hsv_image, channels);
+
+        ForegroundOptimizer foregroundOptimizer(config.cluster_count);
+        cv::Mat foreground = foregroundOptimizer.runHSVThresholding(
+            camera.getBgHsvChannels().at(0),
+            camera.getBgHsvChannels().at(1),
+            camera.getBgHsvChannels().at(2),
+            channels, 0, 19, 48);
+        camera.setForegroundImage(foreground);
+    }
+
+    {
+        // Needs the complete candidate set, not the preview of a lazily built LUT
+        ReconstructionConfig full_lut = config;
+        full_lut.lazy_lut = false;
+        Reconstructor reconstructor(cameras, full_lut);
+        reportPinholeDeviation(reconstructor, cameras);
+    }
+
+    for (const CandidateOrder order : { CandidateOrder::Linear, CandidateOrder::Morton })
+    {
+        config.order = order;
+        Reconstructor reconstructor(cameras, config);
+        reconstructor.update();
+
+        CacheCounter l1d_misses(L1D_CACHE);
+        CacheCounter llc_misses(LAST_LEVEL_CACHE);
+        l1d_misses.start();
+        llc_misses.start();
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+            reconstructor.update();
+        const auto end = std::chrono::steady_clock::now();
+        const int64_t l1d = l1d_misses.stop();
+        const int64_t llc = llc_misses.stop();
+
+        const double ms = std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+        std::cout << getOrderName(order) << ": " << ms << " ms per update, "
+                << reconstructor.getVisibleVoxelIndices().size() << " visible voxels";
+        if (l1d >= 0)
+            std::cout << ", " << l1d / iterations << " L1D read misses";
+        if (llc >= 0)
+            std::cout << ", " << llc / iterations << " LLC read misses";
+        std::cout << " per update" << std::endl;
+
+        const Reconstructor::CarvingStats& stats = reconstructor.getCarvingStats();
+        if (stats.voxels > 0)
+        {
+            std::cout << "  " << stats.lookups / (double) stats.voxels << " lookups per voxel, camera order";
+            for (const size_t c : stats.order)
+                std::cout << " " << c << " (" << 100.0 * stats.rejected[c] / std::max<size_t>(1, stats.tested[c]) << "% rejected)";
+            std::cout << std::endl;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -6,10 +6,12 @@
 #include <Reconstructor.h>
 #include <ForegroundOptimizer.h>
 #include <ClusterLabeler.h>
+#include <ReconstructionConfig.h>
 
 using nl_uu_science_gmt::Camera;
 using nl_uu_science_gmt::ClusterLabeler;
 using nl_uu_science_gmt::ForegroundOptimizer;
+using nl_uu_science_gmt::ReconstructionConfig;
 using nl_uu_science_gmt::Reconstructor;
 
 #define SHOW_RESULTS 1
@@ -18,14 +20,19 @@ int main(int argc, char* argv[])
 {
     bool show_usage = false;
 
-    constexpr uint32_t NUM_CONTOURS = 4;
-    constexpr uint32_t NUM_VIEWS = 4;
     constexpr uint32_t NUM_RETRIES = 40;
     constexpr uint32_t COLOR_CALIBRATION_FRAME_NUMBER = 2 * 672; //949;// (1180 / 2);
     std::vector<Camera> cameras;
     std::filesystem::path data_path = "../data";
+
+    ReconstructionConfig config;
+    if (config.load(data_path / "reconstruction.xml")) {
+        std::cout << "[voxel_clusterer] Using " << data_path / "reconstruction.xml" << std::endl;
+    }
+    const uint32_t NUM_CONTOURS = config.cluster_count;
+    const uint32_t NUM_VIEWS = config.camera_count;
     std::filesystem::path config_file_path = "config.xml";
-    std::filesystem::path background_file_path = "background.png";
+    std::filesystem::path background_file_path = config.seed_background ? "background.png" : "";
     std::filesystem::path video_file_path = "video.avi";
 
 	std::vector<cv::Mat> hsvImages; //one per camera
@@ -68,10 +75,7 @@ int main(int argc, char* argv[])
             v_threshold
         );
 
-        foregroundOptimizer.FindContours(foreground);
-        foregroundOptimizer.SaveMaxContours(1000, 500);
-		
-		foregroundOptimizer.DrawMaxContours(foreground);
+        foregroundOptimizer.KeepMaxComponents(foreground, 1000, 500);
         // Improve the foreground image
         camera.setForegroundImage(foreground);
 
@@ -79,16 +83,40 @@ int main(int argc, char* argv[])
         //cv::waitKey();
     }
 
-    Reconstructor reconstructor(cameras);
+    Reconstructor reconstructor(cameras, config);
     reconstructor.update();
 
     ClusterLabeler labeler(NUM_CONTOURS, NUM_VIEWS);
     auto [centers, labels] = labeler.FindClusters(
         NUM_CONTOURS,
         NUM_RETRIES,
-        reconstructor.getVoxels(),
+        reconstructor.getVoxelGrid(),
         reconstructor.getVisibleVoxelIndices());
 
+    // Carve the persons again on the finer grid, if configured, and dump the voxels of each
+    reconstructor.refine(labels, NUM_CONTOURS);
+    for (const auto& volume : reconstructor.getSubVolumes())
+    {
+        cv::Mat coordinates((int) volume.voxels.size(), 3, CV_32S);
+        for (size_t v = 0; v < volume.voxels.size(); ++v)
+        {
+            const cv::Point3i coordinate = volume.grid.coordinate(volume.voxels[v]);
+            coordinates.at<int>((int) v, 0) = coordinate.x;
+            coordinates.at<int>((int) v, 1) = coordinate.y;
+            coordinates.at<int>((int) v, 2) = coordinate.z;
+        }
+
+        auto output = data_path / ("subvolume" + std::to_string(volume.label + 1) + ".yml");
+        cv::FileStorage file(output.u8string(), cv::FileStorage::WRITE);
+        file << "Label" << volume.label;
+        file << "Origin" << volume.grid.origin;
+        file << "Dimension" << volume.grid.dimension;
+        file << "Step" << volume.grid.step;
+        file << "Voxels" << coordinates;
+        file.release();
+        std::cout << "[voxel_clusterer] Wrote " << volume.voxels.size() << " voxels of cluster " << volume.label + 1 << " to " << output << std::endl;
+    }
+
     std::vector<std::vector<cv::Mat>> masks;
     for (const auto& camera : cameras)
     {
@@ -96,7 +124,7 @@ int main(int argc, char* argv[])
             NUM_CONTOURS,
             camera,
             reconstructor.getVoxelSize() * 0.5f,
-            reconstructor.getVoxels(),
+            reconstructor.getVoxelGrid(),
             reconstructor.getVisibleVoxelIndices(),
             labels));
     }
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+namespace nl_uu_science_gmt
+{
+/*
+ * Minimal std::allocator replacement which hands out memory aligned to
+ * Alignment bytes, so that look up tables can be streamed with aligned
+ * (vector) loads and never straddle a cache line at their start.
+ */
+template <typename T, std::size_t Alignment = 64>
+struct AlignedAllocator
+{
+	using value_type = T;
+
+	template <typename U>
+	struct rebind
+	{
+		using other = AlignedAllocator<U, Alignment>;
+	};
+
+	AlignedAllocator() noexcept = default;
+
+	template <typename U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept
+	{
+	}
+
+	T* allocate(std::size_t n)
+	{
+		return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+	}
+
+	void deallocate(T* p, std::size_t) noexcept
+	{
+		::operator delete(p, std::align_val_t(Alignment));
+	}
+
+	template <typename U>
+	bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept
+	{
+		return true;
+	}
+
+	template <typename U>
+	bool operator!=(const AlignedAllocator<U, Alignment>&) const noexcept
+	{
+		return false;
+	}
+};
+} /* namespace nl_uu_science_gmt */
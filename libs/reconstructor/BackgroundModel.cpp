@@ -0,0 +1,120 @@
+#include "BackgroundModel.h"
+
+#include <cassert>
+#include <cstdint>
+#include <opencv2/imgproc/imgproc.hpp>
+
+namespace nl_uu_science_gmt
+{
+
+namespace
+{
+
+constexpr int FIXED_SHIFT = 8;                          // Fractional bits of the means
+constexpr int32_t HUE_RANGE = 180 << FIXED_SHIFT;      // Full circle of the 8 bit hue
+constexpr int32_t HALF = 1 << (FIXED_SHIFT - 1);
+
+/*
+ * Step of a mean towards a value 'difference' (8.8 fixed point) away,
+ * 1 / 2^shift of it rounded to nearest, so steps up and down are equally
+ * large and the mean isn't biased
+ */
+inline int32_t learningStep(int32_t difference, int shift)
+{
+	return (difference + (1 << (shift - 1))) >> shift;
+}
+
+/*
+ * Move the means towards 'values', the foreground pixels at the slower
+ * 'foreground_shift', and round them to 'channel'. Branch free, so the
+ * loops vectorize.
+ */
+void updateLinear(const uint8_t* values, const uint8_t* foreground, int shift, int foreground_shift, uint16_t* means,
+		uint8_t* channel, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		const int32_t mean = means[i];
+		const int32_t difference = ((int32_t) values[i] << FIXED_SHIFT) - mean;
+		const int32_t next = mean + (foreground[i] ? learningStep(difference, foreground_shift) : learningStep(difference, shift));
+		means[i] = (uint16_t) next;
+		channel[i] = (uint8_t) ((next + HALF) >> FIXED_SHIFT);
+	}
+}
+
+// Hue: the difference is taken the short way around the circle and the mean wrapped back into [0, 180)
+void updateHue(const uint8_t* values, const uint8_t* foreground, int shift, int foreground_shift, uint16_t* means,
+		uint8_t* channel, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		const int32_t mean = means[i];
+		int32_t difference = ((int32_t) values[i] << FIXED_SHIFT) - mean;
+		difference += difference < -HUE_RANGE / 2 ? HUE_RANGE : 0;
+		difference -= difference >= HUE_RANGE / 2 ? HUE_RANGE : 0;
+		int32_t next = mean + (foreground[i] ? learningStep(difference, foreground_shift) : learningStep(difference, shift));
+		next += next < 0 ? HUE_RANGE : 0;
+		next -= next >= HUE_RANGE ? HUE_RANGE : 0;
+		means[i] = (uint16_t) next;
+		const int32_t rounded = (next + HALF) >> FIXED_SHIFT;
+		channel[i] = (uint8_t) (rounded == 180 ? 0 : rounded);
+	}
+}
+
+}
+
+BackgroundModel::BackgroundModel(
+		int learning_shift, int foreground_shift) :
+				m_learning_shift(learning_shift),
+				m_foreground_shift(foreground_shift)
+{
+	assert(learning_shift > 0 && foreground_shift >= learning_shift);
+}
+
+/**
+ * Start the model from the BGR image 'bgr', taking every pixel as background
+ */
+void BackgroundModel::initialize(
+		const cv::Mat &bgr)
+{
+	cv::cvtColor(bgr, m_hsv, cv::COLOR_BGR2HSV);
+	cv::split(m_hsv, m_channels);
+
+	m_means.resize(m_channels.size());
+	for (size_t c = 0; c < m_channels.size(); ++c)
+	{
+		m_channels[c].convertTo(m_means[c], CV_16U, 1 << FIXED_SHIFT);
+		m_channels[c] = m_channels[c].clone();
+	}
+}
+
+/**
+ * Learn the BGR frame 'bgr', the pixels that 'foreground' (0 or 255) marks
+ * as foreground at the slow rate
+ */
+void BackgroundModel::update(
+		const cv::Mat &bgr, const cv::Mat &foreground)
+{
+	if (empty())
+	{
+		initialize(bgr);
+		return;
+	}
+
+	assert(bgr.size() == m_channels[0].size() && foreground.size() == bgr.size() && foreground.type() == CV_8U);
+	cv::cvtColor(bgr, m_hsv, cv::COLOR_BGR2HSV);
+	assert(foreground.isContinuous());
+
+	// Deinterleave first, so the updates run over contiguous planes
+	cv::split(m_hsv, m_values);
+
+	const size_t count = m_hsv.total();
+	const uint8_t* mask = foreground.ptr<uint8_t>();
+	updateHue(m_values[0].ptr<uint8_t>(), mask, m_learning_shift, m_foreground_shift, m_means[0].ptr<uint16_t>(),
+			m_channels[0].ptr<uint8_t>(), count);
+	for (int c = 1; c < 3; ++c)
+		updateLinear(m_values[c].ptr<uint8_t>(), mask, m_learning_shift, m_foreground_shift, m_means[c].ptr<uint16_t>(),
+				m_channels[c].ptr<uint8_t>(), count);
+}
+
+} /* namespace nl_uu_science_gmt */
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+#include <opencv2/core/mat.hpp>
+
+namespace nl_uu_science_gmt
+{
+/*
+ * Online per-pixel background model
+ * Keeps a running mean of every pixel's H, S and V in 8.8 fixed point. Each
+ * update moves the mean of the pixels classified as background 1 / 2^shift
+ * of the way towards the current frame, so slow lighting changes are
+ * followed. Foreground pixels are learned too, at a much slower rate: people
+ * standing still only fade in after many frames, and the ghost left where a
+ * person stood in the frame the model started from clears eventually. Hue
+ * is averaged on the circle: a mean of 178 moving towards 2 passes 0. The
+ * means rounded to 8 bit are what the foreground is subtracted from.
+ */
+class BackgroundModel
+{
+	std::vector<cv::Mat> m_means;     // Per HSV channel the running mean (CV_16U, 8.8 fixed point)
+	std::vector<cv::Mat> m_channels;  // The means rounded to 8 bit
+	cv::Mat m_hsv;                    // The frame being learned in HSV, kept to reuse its buffer
+	std::vector<cv::Mat> m_values;    // The same frame split per HSV channel
+	int m_learning_shift;             // Means move 1 / 2^m_learning_shift towards a background pixel per update
+	int m_foreground_shift;           // Means move 1 / 2^m_foreground_shift towards a foreground pixel per update
+
+public:
+	static constexpr int DEFAULT_LEARNING_SHIFT = 6;
+	static constexpr int DEFAULT_FOREGROUND_SHIFT = 10;
+
+	explicit BackgroundModel(int learning_shift = DEFAULT_LEARNING_SHIFT, int foreground_shift = DEFAULT_FOREGROUND_SHIFT);
+
+	void initialize(const cv::Mat &bgr);
+	void update(const cv::Mat &bgr, const cv::Mat &foreground);
+
+	const std::vector<cv::Mat>& getChannels() const
+	{
+		return m_channels;
+	}
+
+	bool empty() const
+	{
+		return m_channels.empty();
+	}
+};
+} /* namespace nl_uu_science_gmt */
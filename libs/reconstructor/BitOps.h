@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace nl_uu_science_gmt
+{
+/*
+ * Portable helpers for scanning and setting bit-packed voxel masks word by word
+ */
+namespace BitOps
+{
+
+inline int popcount(uint64_t word)
+{
+#ifdef _MSC_VER
+	return (int) __popcnt64(word);
+#else
+	return __builtin_popcountll(word);
+#endif
+}
+
+// Index of the lowest set bit, word must not be 0
+inline int lowestBit(uint64_t word)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, word);
+	return (int) index;
+#else
+	return __builtin_ctzll(word);
+#endif
+}
+
+// Call f(bit) for every set bit in word, lowest first
+template <typename F>
+inline void forEachBit(uint64_t word, F&& f)
+{
+	while (word)
+	{
+		f(lowestBit(word));
+		word &= word - 1;
+	}
+}
+
+/*
+ * Collects bits per occupancy word and ORs them in with one atomic
+ * operation per word, so several threads can set bits of the same word
+ */
+class BitWriter
+{
+	uint64_t* m_occupancy;
+	size_t m_word;
+	uint64_t m_pending;
+
+public:
+	explicit BitWriter(uint64_t* occupancy) :
+			m_occupancy(occupancy),
+			m_word(0),
+			m_pending(0)
+	{
+	}
+
+	~BitWriter()
+	{
+		flush();
+	}
+
+	void set(uint32_t bit)
+	{
+		if ((bit >> 6) != m_word)
+		{
+			flush();
+			m_word = bit >> 6;
+		}
+		m_pending |= uint64_t(1) << (bit & 63);
+	}
+
+	void flush()
+	{
+		if (m_pending)
+		{
+#pragma omp atomic
+			m_occupancy[m_word] |= m_pending;
+		}
+		m_pending = 0;
+	}
+};
+
+} /* namespace BitOps */
+} /* namespace nl_uu_science_gmt */
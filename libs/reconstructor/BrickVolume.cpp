@@ -0,0 +1,194 @@
+#include "BrickVolume.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace nl_uu_science_gmt
+{
+
+namespace
+{
+// Brick and position within the brick of every voxel index
+struct BrickAddress
+{
+	size_t brick;
+	size_t voxel;
+};
+
+inline BrickAddress locate(uint32_t index, const cv::Vec3i &dimension, const cv::Vec3i &bricks)
+{
+	const uint32_t x = index % (uint32_t) dimension[0];
+	const uint32_t y = (index / (uint32_t) dimension[0]) % (uint32_t) dimension[1];
+	const uint32_t z = index / ((uint32_t) dimension[0] * (uint32_t) dimension[1]);
+	constexpr int SHIFT = 3;
+	static_assert(BrickVolume::BRICK_SIZE == 1 << SHIFT, "Brick size must be 2^SHIFT");
+	constexpr uint32_t MASK = BrickVolume::BRICK_SIZE - 1;
+	return BrickAddress {
+		((size_t) (z >> SHIFT) * bricks[1] + (y >> SHIFT)) * bricks[0] + (x >> SHIFT),
+		((z & MASK) << SHIFT | (y & MASK)) << SHIFT | (x & MASK) };
+}
+}
+
+BrickVolume::BrickVolume() :
+		m_allocated(0)
+{
+}
+
+/**
+ * Make the volume 'dimension' voxels large and empty
+ */
+void BrickVolume::resize(
+		const cv::Vec3i &dimension)
+{
+	m_dimension = dimension;
+	for (int d = 0; d < 3; ++d)
+		m_bricks[d] = (dimension[d] + BRICK_SIZE - 1) / BRICK_SIZE;
+
+	const size_t count = getBrickCount();
+	m_table.reset(new std::atomic<Brick*>[count]);
+	m_flags.reset(new std::atomic<uint8_t>[count]);
+	for (size_t b = 0; b < count; ++b)
+	{
+		m_table[b].store(nullptr, std::memory_order_relaxed);
+		m_flags[b].store(0, std::memory_order_relaxed);
+	}
+
+	m_pool.clear();
+	m_free.clear();
+	m_allocated = 0;
+}
+
+/**
+ * Storage of 'brick', taking a zeroed brick from the pool if it has none.
+ * Safe to call from several threads at once.
+ */
+BrickVolume::Brick* BrickVolume::acquire(
+		size_t brick)
+{
+	Brick* storage = m_table[brick].load(std::memory_order_acquire);
+	if (storage)
+		return storage;
+
+	std::lock_guard<std::mutex> lock(m_pool_mutex);
+	storage = m_table[brick].load(std::memory_order_relaxed);
+	if (storage)
+		return storage;
+
+	if (m_free.empty())
+	{
+		storage = &m_pool.emplace_back();
+	}
+	else
+	{
+		storage = m_free.back();
+		m_free.pop_back();
+	}
+	std::fill(std::begin(storage->voxels), std::end(storage->voxels), glm::vec4(0.0f, 0.0f, 0.0f, 0.0f));
+	++m_allocated;
+	m_table[brick].store(storage, std::memory_order_release);
+	return storage;
+}
+
+/**
+ * Writable voxel 'voxel' (volume index), allocating its brick on demand and
+ * flagging it dirty. Threads may write different voxels concurrently.
+ */
+glm::vec4& BrickVolume::at(
+		uint32_t voxel)
+{
+	const BrickAddress address = locate(voxel, m_dimension, m_bricks);
+	m_flags[address.brick].fetch_or(CHANGED | UNCHECKED, std::memory_order_relaxed);
+	return acquire(address.brick)->voxels[address.voxel];
+}
+
+/**
+ * Value of voxel 'voxel' (volume index), zero if its brick isn't allocated
+ */
+glm::vec4 BrickVolume::get(
+		uint32_t voxel) const
+{
+	const BrickAddress address = locate(voxel, m_dimension, m_bricks);
+	const Brick* brick = getBrick((uint32_t) address.brick);
+	return brick ? brick->voxels[address.voxel] : glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+}
+
+/**
+ * Return the bricks written since the last call that no longer hold an
+ * occupied voxel to the pool. Not thread-safe.
+ */
+void BrickVolume::releaseEmptyBricks()
+{
+	const size_t count = getBrickCount();
+	for (size_t b = 0; b < count; ++b)
+	{
+		if (!(m_flags[b].load(std::memory_order_relaxed) & UNCHECKED))
+			continue;
+		m_flags[b].fetch_and((uint8_t) ~UNCHECKED, std::memory_order_relaxed);
+
+		Brick* brick = m_table[b].load(std::memory_order_relaxed);
+		if (brick && std::none_of(std::begin(brick->voxels), std::end(brick->voxels), [](const glm::vec4 &voxel)
+		{
+			return voxel.a != 0.0f;
+		}))
+		{
+			m_table[b].store(nullptr, std::memory_order_relaxed);
+			m_free.push_back(brick);
+			--m_allocated;
+		}
+	}
+}
+
+/**
+ * List the bricks written since the last call (also those released since)
+ * and clear their dirty flag. Not thread-safe.
+ */
+void BrickVolume::takeDirtyBricks(
+		std::vector<uint32_t> &bricks)
+{
+	bricks.clear();
+	const size_t count = getBrickCount();
+	for (size_t b = 0; b < count; ++b)
+	{
+		if (m_flags[b].load(std::memory_order_relaxed) & CHANGED)
+		{
+			m_flags[b].fetch_and((uint8_t) ~CHANGED, std::memory_order_relaxed);
+			bricks.push_back((uint32_t) b);
+		}
+	}
+}
+
+/**
+ * Grid position of the first voxel of 'brick'
+ */
+cv::Vec3i BrickVolume::getBrickOrigin(
+		uint32_t brick) const
+{
+	return cv::Vec3i(
+			(int) (brick % (uint32_t) m_bricks[0]) * BRICK_SIZE,
+			(int) ((brick / (uint32_t) m_bricks[0]) % (uint32_t) m_bricks[1]) * BRICK_SIZE,
+			(int) (brick / ((uint32_t) m_bricks[0] * (uint32_t) m_bricks[1])) * BRICK_SIZE);
+}
+
+/**
+ * Voxels of 'brick' inside the volume in each dimension, less than
+ * BRICK_SIZE for the bricks on the far sides
+ */
+cv::Vec3i BrickVolume::getBrickExtent(
+		uint32_t brick) const
+{
+	const cv::Vec3i origin = getBrickOrigin(brick);
+	return cv::Vec3i(
+			std::min(BRICK_SIZE, m_dimension[0] - origin[0]),
+			std::min(BRICK_SIZE, m_dimension[1] - origin[1]),
+			std::min(BRICK_SIZE, m_dimension[2] - origin[2]));
+}
+
+/**
+ * Heap memory used by the brick table and pool in bytes
+ */
+size_t BrickVolume::getMemoryUsage() const
+{
+	return getBrickCount() * (sizeof(std::atomic<Brick*>) + sizeof(std::atomic<uint8_t>)) + m_pool.size() * sizeof(Brick);
+}
+
+} /* namespace nl_uu_science_gmt */
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <glm/vec4.hpp>
+#include <opencv2/core/matx.hpp>
+
+namespace nl_uu_science_gmt
+{
+/*
+ * Sparse voxel volume
+ * The volume is split into bricks of BRICK_SIZE^3 voxels, stored x fastest.
+ * A brick is taken from a pool the first time one of its voxels is written
+ * and returned once all its voxels are empty again (alpha 0), so memory
+ * scales with the occupied space. Unallocated voxels read as zero. Every
+ * written brick is flagged dirty, so consumers like the GPU upload only
+ * copy the bricks that changed.
+ */
+class BrickVolume
+{
+public:
+	static constexpr int BRICK_SIZE = 8;
+	static constexpr int BRICK_VOXELS = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+
+	struct Brick
+	{
+		glm::vec4 voxels[BRICK_VOXELS];
+	};
+
+private:
+	// Dirty flags of a brick
+	enum : uint8_t
+	{
+		CHANGED = 1,        // Written since the last takeDirtyBricks()
+		UNCHECKED = 2       // Written since the last releaseEmptyBricks()
+	};
+
+	cv::Vec3i m_dimension;                                  // Voxel count in each dimension
+	cv::Vec3i m_bricks;                                     // Brick count in each dimension
+	std::unique_ptr<std::atomic<Brick*>[]> m_table;         // Per brick its storage, or null
+	std::unique_ptr<std::atomic<uint8_t>[]> m_flags;        // Per brick its dirty flags
+	std::deque<Brick> m_pool;                               // Brick storage, addresses never move
+	std::vector<Brick*> m_free;                             // Unused bricks of the pool
+	std::mutex m_pool_mutex;
+	size_t m_allocated;                                     // Bricks in use
+
+	Brick* acquire(size_t brick);
+
+public:
+	BrickVolume();
+
+	BrickVolume(const BrickVolume&) = delete;
+	BrickVolume& operator=(const BrickVolume&) = delete;
+
+	void resize(const cv::Vec3i &dimension);
+
+	glm::vec4& at(uint32_t voxel);
+	glm::vec4 get(uint32_t voxel) const;
+
+	void releaseEmptyBricks();
+	void takeDirtyBricks(std::vector<uint32_t> &bricks);
+
+	cv::Vec3i getBrickOrigin(uint32_t brick) const;
+	cv::Vec3i getBrickExtent(uint32_t brick) const;
+	size_t getMemoryUsage() const;
+
+	// Storage of 'brick', null if none of its voxels is set
+	const Brick* getBrick(uint32_t brick) const
+	{
+		return m_table[brick].load(std::memory_order_acquire);
+	}
+
+	size_t getBrickCount() const
+	{
+		return (size_t) m_bricks[0] * m_bricks[1] * m_bricks[2];
+	}
+
+	size_t getAllocatedBrickCount() const
+	{
+		return m_allocated;
+	}
+
+	const cv::Vec3i& getDimension() const
+	{
+		return m_dimension;
+	}
+};
+} /* namespace nl_uu_science_gmt */
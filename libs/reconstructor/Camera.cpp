@@ -12,8 +12,11 @@
 #include <opencv2/core/mat.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <iostream>
+#include <iterator>
 #include <utility>
 
 using namespace cv;
@@ -21,6 +24,90 @@ using namespace cv;
 namespace nl_uu_science_gmt
 {
 
+namespace
+{
+
+constexpr int64_t PROJECTION_CHUNK = 4096;  // Points projected per parallel work item
+
+/**
+ * The pinhole and distortion model of cv::projectPoints for 5 distortion
+ * coefficients, kept free of function calls so the loop vectorizes
+ */
+struct Projection
+{
+	double m[12];
+	double k1, k2, p1, p2, k3;
+	double fx, fy, cx, cy;
+
+	Projection(const double (&rt)[12], const double (&k)[5], double fx, double fy, double cx, double cy) :
+			k1(k[0]), k2(k[1]), p1(k[2]), p2(k[3]), k3(k[4]), fx(fx), fy(fy), cx(cx), cy(cy)
+	{
+		std::copy(std::begin(rt), std::end(rt), m);
+	}
+
+	template<typename T>
+	void operator()(const Point3f* points, int64_t count, T* pixels) const
+	{
+		for (int64_t i = 0; i < count; ++i)
+		{
+			const double X = points[i].x, Y = points[i].y, Z = points[i].z;
+			double x = m[0] * X + m[1] * Y + m[2] * Z + m[3];
+			double y = m[4] * X + m[5] * Y + m[6] * Z + m[7];
+			double z = m[8] * X + m[9] * Y + m[10] * Z + m[11];
+
+			z = z != 0 ? 1.0 / z : 1.0;
+			x *= z;
+			y *= z;
+
+			double xd, yd;
+			distort(x, y, xd, yd);
+			store(pixels[i], (float) (xd * fx + cx), (float) (yd * fy + cy));
+		}
+	}
+
+	// Apply the lens distortion to the normalized image point (x, y)
+	void distort(double x, double y, double &xd, double &yd) const
+	{
+		const double r2 = x * x + y * y;
+		const double r4 = r2 * r2;
+		const double r6 = r4 * r2;
+		const double a1 = 2 * x * y;
+		const double a2 = r2 + 2 * x * x;
+		const double a3 = r2 + 2 * y * y;
+		const double cdist = 1 + k1 * r2 + k2 * r4 + k3 * r6;
+		xd = x * cdist + p1 * a1 + p2 * a2;
+		yd = y * cdist + p1 * a3 + p2 * a1;
+	}
+
+	static void store(Point2f &pixel, float u, float v)
+	{
+		pixel = Point2f(u, v);
+	}
+
+	// Rounds like the Point2f to Point conversion of the single point API
+	static void store(Point &pixel, float u, float v)
+	{
+		pixel = Point(cvRound(u), cvRound(v));
+	}
+};
+
+template<typename T>
+void projectPoints(const Projection &projection, const Point3f* points, size_t count, T* pixels)
+{
+	const int64_t chunks = ((int64_t) count + PROJECTION_CHUNK - 1) / PROJECTION_CHUNK;
+
+	int64_t i;
+#pragma omp parallel for schedule(static) private(i) if(chunks > 1)
+	for (i = 0; i < chunks; ++i)
+	{
+		const int64_t first = i * PROJECTION_CHUNK;
+		const int64_t last = std::min<int64_t>(first + PROJECTION_CHUNK, (int64_t) count);
+		projection(points + first, last - first, pixels + first);
+	}
+}
+
+} /* namespace */
+
 Camera::Camera(
 		std::filesystem::path dp, std::filesystem::path cp, const int id) :
 				m_data_path(std::move(dp)),
@@ -33,43 +120,53 @@ Camera::Camera(
 	m_fy = 0;
 	m_cx = 0;
 	m_cy = 0;
+	std::fill(std::begin(m_projection), std::end(m_projection), 0.0);
+	std::fill(std::begin(m_distortion), std::end(m_distortion), 0.0);
+	std::fill(std::begin(m_pinhole), std::end(m_pinhole), 0.0);
 	m_frame_amount = 0;
+	m_foreground_generation = 0;
+	m_foreground_changes_valid = false;
+	m_integral_generation = 0;
+	m_undistorted_generation = 0;
 }
 
 Camera::~Camera() = default;
 
 /**
  * Initialize this camera
+ * The background model starts from 'background_image_file' if one is given,
+ * otherwise from the first video frame, and is learned from the video onwards.
  */
 bool Camera::initialize(const std::filesystem::path &background_image_file, const std::filesystem::path &video_file)
 {
 	m_initialized = true;
 
 	Mat bg_image;
-	if (std::filesystem::exists(m_data_path / background_image_file))
+	if (!background_image_file.empty())
 	{
 		bg_image = cv::imread((m_data_path / background_image_file).u8string());
 		if (bg_image.empty())
 		{
-			std::cout << "Unable to read: " << m_data_path / background_image_file << std::endl;
+			std::cout << "Unable to read background image: " << m_data_path / background_image_file << std::endl;
 			return false;
 		}
 	}
-	else
+
+	// Open the video for this camera
+	m_video = VideoCapture((m_data_path / video_file).u8string());
+	assert(m_video.isOpened());
+
+	// Without a background image the model starts from the first frame
+	if (bg_image.empty())
+		m_video >> bg_image;
+	if (bg_image.empty())
 	{
-		std::cout << "Unable to find background image: " << m_data_path / background_image_file << std::endl;
+		std::cout << "Unable to read the first frame of: " << m_data_path / video_file << std::endl;
 		return false;
 	}
-	assert(!bg_image.empty());
 
 	// Disect the background image in HSV-color space
-	Mat bg_hsv_im;
-	cvtColor(bg_image, bg_hsv_im, cv::COLOR_BGR2HSV);
-	split(bg_hsv_im, m_bg_hsv_channels);
-
-	// Open the video for this camera
-	m_video = VideoCapture((m_data_path / video_file).u8string());
-	assert(m_video.isOpened());
+	m_background.initialize(bg_image);
 
 	// Assess the image size
 	m_plane_size.width = (int) m_video.get(cv::CAP_PROP_FRAME_WIDTH);
@@ -120,6 +217,7 @@ bool Camera::initialize(const std::filesystem::path &background_image_file, cons
 	}
 
 	initCamLoc();
+	initProjection();
 	camPtInWorld();
 
 	return m_initialized;
@@ -135,6 +233,136 @@ Mat& Camera::advanceVideoFrame()
 	return m_frame;
 }
 
+/**
+ * Replace the foreground image and record which pixels flipped compared to
+ * the previous one, so consumers can limit their work to the changes
+ */
+void Camera::setForegroundImage(
+		const Mat &foreground_image)
+{
+	m_changed_pixels.clear();
+	m_foreground_changes_valid = !m_foreground_image.empty() && m_foreground_image.size() == foreground_image.size()
+			&& m_foreground_image.type() == foreground_image.type() && m_foreground_image.isContinuous()
+			&& foreground_image.isContinuous() && m_foreground_image.data != foreground_image.data;
+
+	if (m_foreground_changes_valid)
+	{
+		const uchar* previous = m_foreground_image.ptr<uchar>();
+		const uchar* current = foreground_image.ptr<uchar>();
+		const size_t pixels = foreground_image.total();
+
+		// Compare 8 pixels at a time, most of the image doesn't change
+		size_t p = 0;
+		for (; p + 8 <= pixels; p += 8)
+		{
+			uint64_t a, b;
+			std::memcpy(&a, previous + p, sizeof(a));
+			std::memcpy(&b, current + p, sizeof(b));
+			if (a == b)
+				continue;
+			for (size_t i = p; i < p + 8; ++i)
+				if (previous[i] != current[i])
+					m_changed_pixels.push_back((uint32_t) i);
+		}
+		for (; p < pixels; ++p)
+			if (previous[p] != current[p])
+				m_changed_pixels.push_back((uint32_t) p);
+	}
+
+	m_foreground_image = foreground_image;
+	++m_foreground_generation;
+}
+
+/**
+ * Integral image (CV_32S, one row and column larger) of the current
+ * foreground image, so pixel sums over any rectangle cost four look ups
+ */
+const Mat& Camera::getForegroundIntegral() const
+{
+	if (m_integral_generation != m_foreground_generation || m_foreground_integral.empty())
+	{
+		integral(m_foreground_image, m_foreground_integral, CV_32S);
+		m_integral_generation = m_foreground_generation;
+	}
+	return m_foreground_integral;
+}
+
+/**
+ * Nearest neighbour undistortion table, like initUndistortRectifyMap with
+ * the camera matrix kept: for every pixel of the undistorted image the
+ * linear offset of the distorted pixel it shows, or -1 outside the image
+ */
+void Camera::initUndistortTable() const
+{
+	static const double no_rotation[12] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0 };
+	const Projection projection(no_rotation, m_distortion, m_fx, m_fy, m_cx, m_cy);
+	m_undistort_table.resize((size_t) m_plane_size.area());
+
+	int v;
+#pragma omp parallel for schedule(static) private(v)
+	for (v = 0; v < m_plane_size.height; ++v)
+	{
+		int32_t* row = m_undistort_table.data() + (size_t) v * m_plane_size.width;
+		const double y = (v - m_cy) / m_fy;
+		for (int u = 0; u < m_plane_size.width; ++u)
+		{
+			double xd, yd;
+			projection.distort((u - m_cx) / m_fx, y, xd, yd);
+			const int sx = cvRound(xd * m_fx + m_cx);
+			const int sy = cvRound(yd * m_fy + m_cy);
+			row[u] = sx >= 0 && sx < m_plane_size.width && sy >= 0 && sy < m_plane_size.height ?
+					sy * m_plane_size.width + sx : -1;
+		}
+	}
+}
+
+/**
+ * The current foreground image as seen by a distortion free camera with the
+ * same camera matrix (nearest neighbour, pixels from outside the image are
+ * background), so getPinholeProjection() and projectOnUndistortedView() map
+ * straight onto it. Remapped with a gather through the undistortion table.
+ */
+const Mat& Camera::getUndistortedForeground() const
+{
+	if (m_undistort_table.empty())
+		initUndistortTable();
+
+	if (m_undistorted_generation != m_foreground_generation || m_undistorted_foreground.empty())
+	{
+		assert(m_foreground_image.isContinuous() && m_foreground_image.type() == CV_8U);
+		m_undistorted_foreground.create(m_plane_size, CV_8U);
+		const uint8_t* source = m_foreground_image.ptr<uint8_t>();
+		uint8_t* target = m_undistorted_foreground.ptr<uint8_t>();
+		const int32_t* table = m_undistort_table.data();
+
+		int64_t i;
+#pragma omp parallel for schedule(static) private(i)
+		for (i = 0; i < (int64_t) m_undistort_table.size(); ++i)
+			target[i] = table[i] >= 0 ? source[table[i]] : 0;
+		m_undistorted_generation = m_foreground_generation;
+	}
+	return m_undistorted_foreground;
+}
+
+/**
+ * The pixel 'distorted' of the camera image that getUndistortedForeground()
+ * takes its pixel 'pixel' from, false if either lies outside the image
+ */
+bool Camera::getDistortedPixel(
+		const Point &pixel, Point &distorted) const
+{
+	if (m_undistort_table.empty())
+		initUndistortTable();
+
+	if (pixel.x < 0 || pixel.x >= m_plane_size.width || pixel.y < 0 || pixel.y >= m_plane_size.height)
+		return false;
+	const int32_t offset = m_undistort_table[(size_t) pixel.y * m_plane_size.width + pixel.x];
+	if (offset < 0)
+		return false;
+	distorted = Point(offset % m_plane_size.width, offset / m_plane_size.width);
+	return true;
+}
+
 /**
  * Set the video location to the given frame number
  */
@@ -206,6 +434,37 @@ void Camera::initCamLoc()
 	invert(m_rt, m_inverse_rt);
 }
 
+/**
+ * Cache the world to camera transform and distortion coefficients in double
+ * precision, the same precision cv::projectPoints computes in
+ */
+void Camera::initProjection()
+{
+	Mat r;
+	Rodrigues(m_rotation_values, r);
+	r.convertTo(r, CV_64F);
+
+	for (int row = 0; row < 3; ++row)
+	{
+		for (int col = 0; col < 3; ++col)
+			m_projection[row * 4 + col] = r.at<double>(row, col);
+		m_projection[row * 4 + 3] = m_translation_values.at<float>(row, 0);
+	}
+
+	// Only the 5 coefficient model (k1, k2, p1, p2, k3) is supported
+	assert(m_distortion_coeffs.total() <= 5);
+	std::fill(std::begin(m_distortion), std::end(m_distortion), 0.0);
+	for (size_t i = 0; i < std::min<size_t>(m_distortion_coeffs.total(), 5); ++i)
+		m_distortion[i] = m_distortion_coeffs.ptr<float>()[i];
+
+	// K [R|t], the undistorted image keeps the camera matrix
+	const double k[3][3] = { { m_fx, 0, m_cx }, { 0, m_fy, m_cy }, { 0, 0, 1 } };
+	for (int row = 0; row < 3; ++row)
+		for (int col = 0; col < 4; ++col)
+			m_pinhole[row * 4 + col] = k[row][0] * m_projection[col] + k[row][1] * m_projection[4 + col]
+					+ k[row][2] * m_projection[8 + col];
+}
+
 /**
  * Calculate the camera's plane and fov in the 3D scene
  */
@@ -280,7 +539,38 @@ cv::Point Camera::projectOnView(
  */
 Point Camera::projectOnView(const Point3f &coords) const
 {
-	return projectOnView(coords, m_rotation_values, m_translation_values, m_camera_matrix, m_distortion_coeffs);
+	Point pixel;
+	projectOnView(&coords, 1, &pixel);
+	return pixel;
+}
+
+/**
+ * Project 'count' scene points onto this camera's image, writing the
+ * subpixel image coordinates to 'pixels'. Large batches run in parallel
+ */
+void Camera::projectOnView(const Point3f *points, size_t count, Point2f *pixels) const
+{
+	projectPoints(Projection(m_projection, m_distortion, m_fx, m_fy, m_cx, m_cy), points, count, pixels);
+}
+
+/**
+ * Project 'count' scene points onto this camera's image, writing the
+ * rounded pixel coordinates to 'pixels'
+ */
+void Camera::projectOnView(const Point3f *points, size_t count, Point *pixels) const
+{
+	projectPoints(Projection(m_projection, m_distortion, m_fx, m_fy, m_cx, m_cy), points, count, pixels);
+}
+
+/**
+ * Project 'count' scene points onto this camera's undistorted image (see
+ * getUndistortedForeground()), writing the rounded pixel coordinates to
+ * 'pixels'. A pure pinhole projection, no distortion terms.
+ */
+void Camera::projectOnUndistortedView(const Point3f *points, size_t count, Point *pixels) const
+{
+	static const double no_distortion[5] = { 0, 0, 0, 0, 0 };
+	projectPoints(Projection(m_projection, no_distortion, m_fx, m_fy, m_cx, m_cy), points, count, pixels);
 }
 
 } /* namespace nl_uu_science_gmt */
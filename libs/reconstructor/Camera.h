@@ -15,6 +15,8 @@
 #include <string>
 #include <vector>
 
+#include "BackgroundModel.h"
+
 namespace nl_uu_science_gmt
 {
 
@@ -26,8 +28,16 @@ class Camera
 	const std::filesystem::path m_cam_props_file;   // Camera properties filename
 	const int m_id;                                 // Camera ID
 
-	std::vector<cv::Mat> m_bg_hsv_channels;          // Background HSV channel images
+	BackgroundModel m_background;                    // Background HSV channel images, learned online
 	cv::Mat m_foreground_image;                      // This camera's foreground image (binary)
+	uint64_t m_foreground_generation;                // Amount of foreground images set so far
+	bool m_foreground_changes_valid;                 // Whether m_changed_pixels is relative to the previous image
+	std::vector<uint32_t> m_changed_pixels;          // Linear offsets of pixels that flipped since the previous image
+	mutable cv::Mat m_foreground_integral;           // Integral image of m_foreground_image, computed on demand
+	mutable uint64_t m_integral_generation;          // Foreground generation m_foreground_integral belongs to
+	mutable std::vector<int32_t> m_undistort_table;  // Per undistorted pixel its distorted pixel offset (-1 outside), computed on demand
+	mutable cv::Mat m_undistorted_foreground;        // m_foreground_image with the lens distortion removed
+	mutable uint64_t m_undistorted_generation;       // Foreground generation m_undistorted_foreground belongs to
 
 	cv::VideoCapture m_video;                        // Video reader
 
@@ -41,6 +51,10 @@ class Camera
 
 	float m_fx, m_fy, m_cx, m_cy;                   // Focal lenghth (fx, fy), camera center (cx, cy)
 
+	double m_projection[12];                         // World to camera transform [R|t] (3x4, row major)
+	double m_distortion[5];                          // Distortion coefficients k1, k2, p1, p2, k3
+	double m_pinhole[12];                            // Projection K [R|t] onto the undistorted image (3x4, row major)
+
 	cv::Mat m_rt;                                    // R matrix
 	cv::Mat m_inverse_rt;                            // R's inverse matrix
 
@@ -54,6 +68,8 @@ class Camera
 	cv::Point m_MousePosition;                       // position of mouse for helping select corners
 
 	void initCamLoc();
+	void initProjection();
+	void initUndistortTable() const;
 	inline void camPtInWorld();
 
 	cv::Point3f ptToW3D(const cv::Point &);
@@ -71,6 +87,9 @@ public:
 
 	static cv::Point projectOnView(const cv::Point3f &, const cv::Mat &, const cv::Mat &, const cv::Mat &, const cv::Mat &);
 	cv::Point projectOnView(const cv::Point3f &) const;
+	void projectOnView(const cv::Point3f *, size_t, cv::Point2f *) const;
+	void projectOnView(const cv::Point3f *, size_t, cv::Point *) const;
+	void projectOnUndistortedView(const cv::Point3f *, size_t, cv::Point *) const;
 
 	const std::filesystem::path& getCamPropertiesFile() const
 	{
@@ -104,7 +123,13 @@ public:
 
 	const std::vector<cv::Mat>& getBgHsvChannels() const
 	{
-		return m_bg_hsv_channels;
+		return m_background.getChannels();
+	}
+
+	// Learn the current frame into the background, slowly where 'foreground' is set
+	void updateBackground(const cv::Mat &foreground)
+	{
+		m_background.update(m_frame, foreground);
 	}
 
 	bool isInitialized() const
@@ -122,9 +147,31 @@ public:
 		return m_foreground_image;
 	}
 
-	void setForegroundImage(const cv::Mat& foregroundImage)
+	void setForegroundImage(const cv::Mat& foregroundImage);
+
+	const cv::Mat& getForegroundIntegral() const;
+	const cv::Mat& getUndistortedForeground() const;
+	bool getDistortedPixel(const cv::Point &, cv::Point &) const;
+
+	// Distortion free projection matrix, maps onto getUndistortedForeground()
+	const double* getPinholeProjection() const
+	{
+		return m_pinhole;
+	}
+
+	uint64_t getForegroundGeneration() const
+	{
+		return m_foreground_generation;
+	}
+
+	bool hasForegroundChanges() const
+	{
+		return m_foreground_changes_valid;
+	}
+
+	const std::vector<uint32_t>& getChangedPixels() const
 	{
-		m_foreground_image = foregroundImage;
+		return m_changed_pixels;
 	}
 
 	const cv::Mat& getFrame() const
@@ -132,6 +179,26 @@ public:
 		return m_frame;
 	}
 
+	const cv::Mat& getCameraMatrix() const
+	{
+		return m_camera_matrix;
+	}
+
+	const cv::Mat& getDistortionCoeffs() const
+	{
+		return m_distortion_coeffs;
+	}
+
+	const cv::Mat& getRotationValues() const
+	{
+		return m_rotation_values;
+	}
+
+	const cv::Mat& getTranslationValues() const
+	{
+		return m_translation_values;
+	}
+
 	const std::vector<cv::Point3f>& getCameraFloor() const
 	{
 		return m_camera_floor;
@@ -0,0 +1,284 @@
+#include "CarvingKernel.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include "BitOps.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CARVING_KERNEL_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(CARVING_KERNEL_X86) && (defined(__GNUC__) || defined(__clang__))
+#define CARVING_TARGET(isa) __attribute__((target(isa)))
+#else
+#define CARVING_TARGET(isa)
+#endif
+
+namespace nl_uu_science_gmt
+{
+namespace CarvingKernel
+{
+
+namespace
+{
+
+/*
+ * Every kernel is instantiated for a fixed amount of cameras, so the camera
+ * loops are unrolled and the row pointers stay in registers, and once with
+ * CAMERAS = 0 for any other amount (read from the input at run time)
+ */
+template<size_t CAMERAS>
+inline size_t getCameraCount(const CarvingInput& in)
+{
+	return CAMERAS ? CAMERAS : in.camera_count;
+}
+
+// Voxels of the word that are valid on all cameras
+template<size_t CAMERAS>
+inline uint64_t getValidWord(const CarvingInput& in, size_t word)
+{
+	uint64_t valid = ~uint64_t(0);
+	for (size_t c = 0; c < getCameraCount<CAMERAS>(in); ++c)
+		valid &= in.valid[c][word];
+	return valid;
+}
+
+/*
+ * Scalar: the validity words are ANDed first, then every remaining voxel is
+ * tested camera by camera and dropped at its first background pixel
+ */
+template<size_t CAMERAS>
+uint64_t carveScalar(const CarvingInput& in, size_t word, CarvingCounters& counters)
+{
+	const size_t first = word * 64;
+	const size_t camera_count = getCameraCount<CAMERAS>(in);
+	const uint64_t candidates = getValidWord<CAMERAS>(in, word);
+	counters.entered += BitOps::popcount(candidates);
+
+	uint64_t result = 0;
+	BitOps::forEachBit(candidates, [&](int i)
+	{
+		size_t c = 0;
+		while (c < camera_count && in.foregrounds[c][in.offsets[c][first + i]] == 255)
+			++c;
+		if (c == camera_count)
+			result |= uint64_t(1) << i;
+		else
+			++counters.rejected[c];
+	});
+	return result;
+}
+
+#ifdef CARVING_KERNEL_X86
+
+/*
+ * SSE4.1: no gather instruction, so the 16 foreground bytes of a group are
+ * inserted into one register and compared against 255 at once
+ */
+template<size_t CAMERAS>
+CARVING_TARGET("sse4.1")
+uint64_t carveSSE41(const CarvingInput& in, size_t word, CarvingCounters& counters)
+{
+	const size_t first = word * 64;
+	const size_t camera_count = getCameraCount<CAMERAS>(in);
+	const __m128i white = _mm_set1_epi8((char) 0xFF);
+	uint64_t result = getValidWord<CAMERAS>(in, word);
+	counters.entered += BitOps::popcount(result);
+	for (size_t c = 0; c < camera_count && result; ++c)
+	{
+		const uint32_t* offsets = in.offsets[c] + first;
+		const uint8_t* fg = in.foregrounds[c];
+		uint64_t bits = 0;
+		for (int g = 0; g < 64; g += 16)
+		{
+			// Skip groups in which every voxel is already carved away
+			if (((result >> g) & 0xFFFF) == 0)
+				continue;
+
+			const uint32_t* o = offsets + g;
+			__m128i bytes = _mm_cvtsi32_si128(fg[o[0]]);
+			bytes = _mm_insert_epi8(bytes, fg[o[1]], 1);
+			bytes = _mm_insert_epi8(bytes, fg[o[2]], 2);
+			bytes = _mm_insert_epi8(bytes, fg[o[3]], 3);
+			bytes = _mm_insert_epi8(bytes, fg[o[4]], 4);
+			bytes = _mm_insert_epi8(bytes, fg[o[5]], 5);
+			bytes = _mm_insert_epi8(bytes, fg[o[6]], 6);
+			bytes = _mm_insert_epi8(bytes, fg[o[7]], 7);
+			bytes = _mm_insert_epi8(bytes, fg[o[8]], 8);
+			bytes = _mm_insert_epi8(bytes, fg[o[9]], 9);
+			bytes = _mm_insert_epi8(bytes, fg[o[10]], 10);
+			bytes = _mm_insert_epi8(bytes, fg[o[11]], 11);
+			bytes = _mm_insert_epi8(bytes, fg[o[12]], 12);
+			bytes = _mm_insert_epi8(bytes, fg[o[13]], 13);
+			bytes = _mm_insert_epi8(bytes, fg[o[14]], 14);
+			bytes = _mm_insert_epi8(bytes, fg[o[15]], 15);
+			const uint32_t mask = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, white));
+			bits |= uint64_t(mask) << g;
+		}
+		counters.rejected[c] += BitOps::popcount(result & ~bits);
+		result &= bits;
+	}
+	return result;
+}
+
+/*
+ * AVX2: gather 8 foreground bytes per instruction. A 32 bit gather at the
+ * pixel offset itself could read up to 3 bytes past the end of the image,
+ * so every lane loads the 4 bytes ending at its pixel instead (or starting
+ * at it for the first 3 pixels) and shifts its byte down.
+ */
+template<size_t CAMERAS>
+CARVING_TARGET("avx2")
+uint64_t carveAVX2(const CarvingInput& in, size_t word, CarvingCounters& counters)
+{
+	const size_t first = word * 64;
+	const size_t camera_count = getCameraCount<CAMERAS>(in);
+	const __m256i three = _mm256_set1_epi32(3);
+	const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+	uint64_t result = getValidWord<CAMERAS>(in, word);
+	counters.entered += BitOps::popcount(result);
+	for (size_t c = 0; c < camera_count && result; ++c)
+	{
+		const uint32_t* offsets = in.offsets[c] + first;
+		const int* fg = reinterpret_cast<const int*>(in.foregrounds[c]);
+		uint64_t bits = 0;
+		for (int g = 0; g < 64; g += 8)
+		{
+			// Skip groups in which every voxel is already carved away
+			if (((result >> g) & 0xFF) == 0)
+				continue;
+
+			const __m256i offset = _mm256_load_si256(reinterpret_cast<const __m256i*>(offsets + g));
+			const __m256i start = _mm256_sub_epi32(_mm256_max_epu32(offset, three), three);
+			const __m256i shift = _mm256_slli_epi32(_mm256_sub_epi32(offset, start), 3);
+			__m256i pixels = _mm256_i32gather_epi32(fg, start, 1);
+			pixels = _mm256_and_si256(_mm256_srlv_epi32(pixels, shift), byte_mask);
+			const __m256i white = _mm256_cmpeq_epi32(pixels, byte_mask);
+			const uint32_t mask = (uint32_t) _mm256_movemask_ps(_mm256_castsi256_ps(white));
+			bits |= uint64_t(mask) << g;
+		}
+		counters.rejected[c] += BitOps::popcount(result & ~bits);
+		result &= bits;
+	}
+	return result;
+}
+
+bool cpuSupports(Isa isa)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	int info[4];
+	__cpuid(info, 0);
+	const int max_leaf = info[0];
+	__cpuid(info, 1);
+	const bool sse41 = (info[2] & (1 << 19)) != 0;
+	const bool os_avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+	bool avx2 = false;
+	if (max_leaf >= 7 && os_avx)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	const bool sse41 = __builtin_cpu_supports("sse4.1");
+	const bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+	switch (isa)
+	{
+	case Isa::AVX2:
+		return avx2;
+	case Isa::SSE41:
+		return sse41;
+	default:
+		return true;
+	}
+}
+
+#else
+
+bool cpuSupports(Isa isa)
+{
+	return isa == Isa::Scalar;
+}
+
+#endif
+
+template<size_t CAMERAS>
+Function selectFor(Isa isa)
+{
+	switch (isa)
+	{
+#ifdef CARVING_KERNEL_X86
+	case Isa::AVX2:
+		return carveAVX2<CAMERAS>;
+	case Isa::SSE41:
+		return carveSSE41<CAMERAS>;
+#endif
+	default:
+		return carveScalar<CAMERAS>;
+	}
+}
+
+} /* namespace */
+
+Isa detect()
+{
+	Isa requested = Isa::AVX2;
+	if (const char* env = std::getenv("VOXEL_CARVING_ISA"))
+	{
+		if (std::strcmp(env, "scalar") == 0)
+			requested = Isa::Scalar;
+		else if (std::strcmp(env, "sse41") == 0)
+			requested = Isa::SSE41;
+	}
+
+	if (requested == Isa::AVX2 && cpuSupports(Isa::AVX2))
+		return Isa::AVX2;
+	if (requested != Isa::Scalar && cpuSupports(Isa::SSE41))
+		return Isa::SSE41;
+	return Isa::Scalar;
+}
+
+Function select(Isa isa, size_t camera_count)
+{
+	switch (camera_count)
+	{
+	case 2:
+		return selectFor<2>(isa);
+	case 3:
+		return selectFor<3>(isa);
+	case 4:
+		return selectFor<4>(isa);
+	case 5:
+		return selectFor<5>(isa);
+	case 6:
+		return selectFor<6>(isa);
+	case 7:
+		return selectFor<7>(isa);
+	case 8:
+		return selectFor<8>(isa);
+	default:
+		return selectFor<0>(isa);
+	}
+}
+
+const char* getName(Isa isa)
+{
+	switch (isa)
+	{
+	case Isa::AVX2:
+		return "AVX2";
+	case Isa::SSE41:
+		return "SSE4.1";
+	default:
+		return "scalar";
+	}
+}
+
+} /* namespace CarvingKernel */
+} /* namespace nl_uu_science_gmt */
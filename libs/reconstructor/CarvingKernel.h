@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace nl_uu_science_gmt
+{
+/*
+ * Per-frame view of everything the carving kernels read: for every camera
+ * the look up table row of linear pixel offsets, its validity bitmask and
+ * the foreground image (continuous, 0 or 255 per pixel).
+ */
+struct CarvingInput
+{
+	const uint32_t* const* offsets;      // offsets[c][v]: pixel offset of voxel v on camera c
+	const uint64_t* const* valid;        // valid[c][w]: validity bits of voxels [64w, 64w + 64)
+	const uint8_t* const* foregrounds;   // foregrounds[c]: camera c's foreground image
+	size_t camera_count;
+};
+
+/*
+ * Early exit counters of the carving kernels, one set per thread. The
+ * kernels add the voxels valid on all cameras to 'entered' and the voxels
+ * carved away by the k-th tested camera to rejected[k].
+ */
+struct CarvingCounters
+{
+	uint64_t entered;
+	uint64_t* rejected;                  // camera_count counters, by test position
+};
+
+/*
+ * Voxel carving kernels
+ * Every kernel computes one 64 bit occupancy word: bit i is set if voxel
+ * 64 * word + i projects onto foreground on all cameras. The cameras are
+ * ANDed in the order of the input arrays and the kernel returns as soon as
+ * the word runs empty.
+ * Rigs of 2 to 8 cameras get a kernel specialized on their camera count.
+ */
+namespace CarvingKernel
+{
+
+enum class Isa
+{
+	Scalar,
+	SSE41,
+	AVX2
+};
+
+using Function = uint64_t (*)(const CarvingInput&, size_t word, CarvingCounters&);
+
+// Best instruction set supported by this CPU, can be lowered with the
+// VOXEL_CARVING_ISA environment variable (scalar, sse41 or avx2)
+Isa detect();
+Function select(Isa isa, size_t camera_count);
+const char* getName(Isa isa);
+
+} /* namespace CarvingKernel */
+} /* namespace nl_uu_science_gmt */
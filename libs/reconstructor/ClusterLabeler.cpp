@@ -12,7 +12,7 @@
 
 using nl_uu_science_gmt::Camera;
 using nl_uu_science_gmt::ClusterLabeler;
-using nl_uu_science_gmt::Voxel;
+using nl_uu_science_gmt::VoxelGrid;
 
 
 
@@ -20,13 +20,14 @@ using nl_uu_science_gmt::Voxel;
 
 
 
-std::pair<cv::Mat, std::vector<int>> ClusterLabeler::FindClusters(uint8_t num_clusters, uint8_t num_retries, const std::vector<Voxel> &voxels, const std::vector<uint32_t> &indices)
+std::pair<cv::Mat, std::vector<int>> ClusterLabeler::FindClusters(uint8_t num_clusters, uint8_t num_retries, const VoxelGrid &grid, const std::vector<uint32_t> &indices)
 {
 	// Project the voxels into 2d, ignoring up vector
 	std::vector<cv::Point2f> voxels_2d;
 	voxels_2d.reserve(indices.size());
 	for (auto i : indices) {
-		voxels_2d.emplace_back(voxels[i].coordinate.x, voxels[i].coordinate.y);
+		const cv::Point3i coordinate = grid.coordinate(i);
+		voxels_2d.emplace_back(coordinate.x, coordinate.y);
 	}
 
 	// Run k-means for labels and centers
@@ -38,7 +39,7 @@ std::pair<cv::Mat, std::vector<int>> ClusterLabeler::FindClusters(uint8_t num_cl
 	return std::make_pair(centers, labels);
 }
 
-std::vector<cv::Mat> nl_uu_science_gmt::ClusterLabeler::ProjectTShirt(uint8_t num_clusters, const Camera& camera, float voxel_step_size, const std::vector<Voxel> &voxels, const std::vector<uint32_t> &indices, const std::vector<int> &labels)
+std::vector<cv::Mat> nl_uu_science_gmt::ClusterLabeler::ProjectTShirt(uint8_t num_clusters, const Camera& camera, float voxel_step_size, const VoxelGrid &grid, const std::vector<uint32_t> &indices, const std::vector<int> &labels)
 {
 	constexpr float t_shirt_min_z = 800.0f;
 	constexpr float t_shirt_max_z = 1400.0f;
@@ -49,27 +50,42 @@ std::vector<cv::Mat> nl_uu_science_gmt::ClusterLabeler::ProjectTShirt(uint8_t nu
 		mask = cv::Mat::zeros(camera.getSize(), CV_8U);
 	}
 
+	// Gather the 8 corners of every voxel at shirt height
+	std::vector<cv::Point3f> corners;
+	std::vector<int> corner_labels;
+	corners.reserve(labels.size() * 8);
+	corner_labels.reserve(labels.size());
 	for (uint32_t i = 0; i < labels.size(); ++i)
 	{
-		auto person_index = labels[i];
-		auto voxel_index = indices[i];
-		auto& voxel = voxels[voxel_index];
+		const cv::Point3i coordinate = grid.coordinate(indices[i]);
 		// Cull voxels which are too low or too high to be part of the shirt
-		if (voxel.coordinate.z < t_shirt_min_z || voxel.coordinate.z > t_shirt_max_z)
+		if (coordinate.z < t_shirt_min_z || coordinate.z > t_shirt_max_z)
 		{
 			continue;
 		}
-		auto& mask = masks[person_index];
-		mask.at<uint8_t>(camera.projectOnView(voxel.coordinate)) = 0xFF;
+		corner_labels.push_back(labels[i]);
+
+		const cv::Point3f origin(coordinate);
+		corners.push_back(origin);
+		corners.push_back(origin + cv::Point3f(voxel_step_size, 0, 0));
+		corners.push_back(origin + cv::Point3f(voxel_step_size, voxel_step_size, 0));
+		corners.push_back(origin + cv::Point3f(0, voxel_step_size, 0));
+		corners.push_back(origin + cv::Point3f(0, voxel_step_size, voxel_step_size));
+		corners.push_back(origin + cv::Point3f(0, 0, voxel_step_size));
+		corners.push_back(origin + cv::Point3f(voxel_step_size, 0, voxel_step_size));
+		corners.push_back(origin + cv::Point3f(voxel_step_size, voxel_step_size, voxel_step_size));
+	}
 
+	std::vector<cv::Point> pixels(corners.size());
+	camera.projectOnView(corners.data(), corners.size(), pixels.data());
 
-		mask.at<uint8_t>(camera.projectOnView(cv::Point3f(voxel.coordinate) + cv::Point3f(voxel_step_size, 0, 0))) = 0xFF;
-		mask.at<uint8_t>(camera.projectOnView(cv::Point3f(voxel.coordinate) + cv::Point3f(voxel_step_size, voxel_step_size, 0))) = 0xFF;
-		mask.at<uint8_t>(camera.projectOnView(cv::Point3f(voxel.coordinate) + cv::Point3f(0, voxel_step_size, 0))) = 0xFF;
-		mask.at<uint8_t>(camera.projectOnView(cv::Point3f(voxel.coordinate) + cv::Point3f(0, voxel_step_size, voxel_step_size))) = 0xFF;
-		mask.at<uint8_t>(camera.projectOnView(cv::Point3f(voxel.coordinate) + cv::Point3f(0, 0, voxel_step_size))) = 0xFF;
-		mask.at<uint8_t>(camera.projectOnView(cv::Point3f(voxel.coordinate) + cv::Point3f(voxel_step_size, 0, voxel_step_size))) = 0xFF;
-		mask.at<uint8_t>(camera.projectOnView(cv::Point3f(voxel.coordinate) + cv::Point3f(voxel_step_size, voxel_step_size, voxel_step_size))) = 0xFF;
+	const cv::Rect image(cv::Point(0, 0), camera.getSize());
+	for (size_t i = 0; i < pixels.size(); ++i)
+	{
+		if (image.contains(pixels[i]))
+		{
+			masks[corner_labels[i / 8]].at<uint8_t>(pixels[i]) = 0xFF;
+		}
 	}
 
 	return masks;
@@ -78,13 +94,11 @@ std::vector<cv::Mat> nl_uu_science_gmt::ClusterLabeler::ProjectTShirt(uint8_t nu
 void ClusterLabeler::CleanupMasks(std::vector<std::vector<cv::Mat>> &masks)
 {
 	ForegroundOptimizer optimizer(1);
-	for (auto camera : masks)
+	for (auto& camera : masks)
 	{
-		for (auto mask : camera)
+		for (auto& mask : camera)
 		{
-			optimizer.FindContours(mask);
-			optimizer.SaveMaxContours(1000, 50);
-			optimizer.DrawMaxContours(mask);
+			optimizer.KeepMaxComponents(mask, 1000, 50);
 		}
 	}
 }
@@ -7,9 +7,8 @@
 #include <opencv2/core.hpp>
 #include <opencv2/ml/ml.hpp> //EM include, use with cv::ml::EM
 
+#include "ReconstructionConfig.h"
 #include "Voxel.h"
-constexpr uint32_t NUM_CONTOURS = 4;
-constexpr uint32_t NUM_VIEWS = 4;
 
 namespace nl_uu_science_gmt
 {
@@ -23,8 +22,8 @@ private:
 	int m_numClusters;
 	int m_numCameras;
 public:
-	std::pair<cv::Mat, std::vector<int>> FindClusters(uint8_t num_clusters, uint8_t num_retries, const std::vector<Voxel> &voxels, const std::vector<uint32_t> &indices);
-	std::vector<cv::Mat> ProjectTShirt(uint8_t num_clusters, const Camera& cameras, float voxel_step_size, const std::vector<Voxel> &voxels, const std::vector<uint32_t> &indices, const std::vector<int> &labels);
+	std::pair<cv::Mat, std::vector<int>> FindClusters(uint8_t num_clusters, uint8_t num_retries, const VoxelGrid &grid, const std::vector<uint32_t> &indices);
+	std::vector<cv::Mat> ProjectTShirt(uint8_t num_clusters, const Camera& cameras, float voxel_step_size, const VoxelGrid &grid, const std::vector<uint32_t> &indices, const std::vector<int> &labels);
 	void CleanupMasks(std::vector<std::vector<cv::Mat>>& masks);
 	void ShowMaskCutouts(std::vector<std::vector<cv::Mat>>& masks, std::vector<cv::Mat>& hsvImages, std::vector<std::vector<cv::Mat>>& cutouts);
 	void TrainEMS(std::vector<std::vector<cv::Mat>>& masks, std::vector<cv::Mat>& hsvImages, std::vector<std::vector<cv::Mat>>& reshaped_cutouts);
@@ -39,15 +38,18 @@ public:
 	int getNumClusters() { return m_numClusters; }
 	int getNumCameras() { return m_numCameras; }
 
-	//clusterLabeler will have the defined number of clusters and camera's in ClusterLabeler.h by default.
+	//clusterLabeler will have the default number of clusters and camera's of ReconstructionConfig by default.
 	ClusterLabeler(int numClusters, int numCameras) :
 		m_numClusters(numClusters),
 		m_numCameras(numCameras)
 	{};
 
 	ClusterLabeler() :
-		m_numClusters(NUM_CONTOURS),
-		m_numCameras(NUM_VIEWS)
+		ClusterLabeler(ReconstructionConfig().cluster_count, ReconstructionConfig().camera_count)
+	{};
+
+	explicit ClusterLabeler(const ReconstructionConfig &config) :
+		ClusterLabeler(config.cluster_count, config.camera_count)
 	{};
 };
 
@@ -0,0 +1,144 @@
+#include "ClusterRefiner.h"
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cmath>
+#include <numeric>
+
+#include "BitOps.h"
+#include "OnTheFlyCarver.h"
+
+namespace nl_uu_science_gmt
+{
+
+namespace
+{
+
+/*
+ * First fine voxel center and the amount of them along one axis covering
+ * [lower, upper] (mm), on the lattice of step 'step' through 'origin'
+ */
+void snapRange(
+		int origin, int step, double lower, double upper, int &first, int &count)
+{
+	const int k0 = (int) std::floor((lower - origin) / step);
+	const int k1 = (int) std::ceil((upper - origin) / step);
+	first = origin + k0 * step;
+	count = std::max(k1 - k0 + 1, 1);
+}
+
+}
+
+ClusterRefiner::ClusterRefiner(
+		int step, int padding) :
+				m_step(step),
+				m_padding(padding),
+				m_tested_voxels(0)
+{
+}
+
+/**
+ * Carve a fine sub-volume around every cluster of the coarse voxels
+ * 'indices' of 'grid', 'labels' holding the cluster of each. The padded
+ * bounding boxes are clipped to the coarse volume. 'masks' are the
+ * cameras' undistorted foreground images.
+ */
+void ClusterRefiner::refine(
+		const VoxelGrid &grid, const std::vector<uint32_t> &indices, const std::vector<int> &labels,
+		int cluster_count, const std::vector<Camera> &cameras, const std::vector<const uint8_t*> &masks)
+{
+	assert(labels.size() == indices.size() && masks.size() == cameras.size());
+	m_tested_voxels = 0;
+	if (!isEnabled() || cluster_count <= 0)
+	{
+		m_volumes.clear();
+		return;
+	}
+
+	// Bounding box of each cluster's voxel centers
+	std::vector<cv::Point3i> lower(cluster_count, cv::Point3i(INT_MAX, INT_MAX, INT_MAX));
+	std::vector<cv::Point3i> upper(cluster_count, cv::Point3i(INT_MIN, INT_MIN, INT_MIN));
+	for (size_t i = 0; i < indices.size(); ++i)
+	{
+		const int label = labels[i];
+		if (label < 0 || label >= cluster_count)
+			continue;
+		const cv::Point3i p = grid.coordinate(indices[i]);
+		lower[label] = cv::Point3i(std::min(lower[label].x, p.x), std::min(lower[label].y, p.y), std::min(lower[label].z, p.z));
+		upper[label] = cv::Point3i(std::max(upper[label].x, p.x), std::max(upper[label].y, p.y), std::max(upper[label].z, p.z));
+	}
+
+	// The coarse volume, each voxel covering half a step around its center
+	const double half = grid.step * 0.5;
+	const int origin[] = { grid.origin.x, grid.origin.y, grid.origin.z };
+
+	size_t count = 0;
+	for (int label = 0; label < cluster_count; ++label)
+	{
+		if (lower[label].x > upper[label].x)
+			continue;
+
+		if (count == m_volumes.size())
+			m_volumes.emplace_back();
+		SubVolume& volume = m_volumes[count++];
+		volume.label = label;
+		volume.voxels.clear();
+		volume.color = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+		const int low[] = { lower[label].x, lower[label].y, lower[label].z };
+		const int high[] = { upper[label].x, upper[label].y, upper[label].z };
+		int first[3];
+		for (int a = 0; a < 3; ++a)
+		{
+			const double bound_low = origin[a] - half;
+			const double bound_high = origin[a] + (grid.dimension[a] - 1) * grid.step + half;
+			snapRange(origin[a], m_step, std::max(low[a] - half - m_padding, bound_low),
+					std::min(high[a] + half + m_padding, bound_high), first[a], volume.grid.dimension[a]);
+		}
+		volume.grid.origin = cv::Point3i(first[0], first[1], first[2]);
+		volume.grid.step = m_step;
+
+		OnTheFlyCarver carver;
+		carver.build(volume.grid, cameras);
+
+		const size_t voxel_count = volume.grid.size();
+		std::vector<uint64_t> occupancy((voxel_count + 63) / 64);
+
+		int64_t w;
+#pragma omp parallel for schedule(dynamic) private(w)
+		for (w = 0; w < (int64_t) occupancy.size(); ++w)
+		{
+			uint32_t voxels[64];
+			const uint32_t first_voxel = (uint32_t) w * 64;
+			const size_t word_count = std::min<size_t>(64, voxel_count - first_voxel);
+			std::iota(voxels, voxels + word_count, first_voxel);
+			occupancy[w] = carver.carveWord(voxels, word_count, masks);
+		}
+
+		for (size_t i = 0; i < occupancy.size(); ++i)
+		{
+			BitOps::forEachBit(occupancy[i], [&](int bit)
+			{
+				volume.voxels.push_back((uint32_t) (i * 64 + bit));
+			});
+		}
+		m_tested_voxels += voxel_count;
+	}
+	m_volumes.resize(count);
+}
+
+/**
+ * Give every sub-volume the color of its cluster, 'colors' holding one per label
+ */
+void ClusterRefiner::color(
+		const std::vector<glm::vec4> &colors)
+{
+	for (SubVolume& volume : m_volumes)
+	{
+		assert(volume.label < (int) colors.size());
+		volume.color = colors[volume.label];
+	}
+}
+
+} /* namespace nl_uu_science_gmt */
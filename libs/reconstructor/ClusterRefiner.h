@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/vec4.hpp>
+
+#include "Camera.h"
+#include "Voxel.h"
+
+namespace nl_uu_science_gmt
+{
+/*
+ * A finer voxel grid around one cluster, see ClusterRefiner
+ */
+struct SubVolume
+{
+	int label;                       // Cluster the sub-volume refines
+	VoxelGrid grid;                  // Fine grid over the cluster's padded bounding box
+	std::vector<uint32_t> voxels;    // Occupied voxels of 'grid', ascending
+	glm::vec4 color;                 // Color of the cluster, see ClusterRefiner::color
+};
+
+/*
+ * Adaptive refinement around the located persons
+ * Once the coarse voxels are clustered, everything outside the clusters is
+ * known to be empty. Per cluster the bounding box of its voxels is padded,
+ * snapped to a finer step and carved again on its own grid, projecting on
+ * the fly onto the undistorted foreground images. The coarse volume is left
+ * as is, the fine grids are kept as separate sub-volumes.
+ */
+class ClusterRefiner
+{
+	int m_step;                      // Voxel step of the sub-volumes (mm), 0 disables refining
+	int m_padding;                   // Margin added around each cluster's bounding box (mm)
+	std::vector<SubVolume> m_volumes;
+	size_t m_tested_voxels;          // Fine voxels carved in the last refine()
+
+public:
+	ClusterRefiner(int step, int padding);
+
+	void refine(const VoxelGrid &grid, const std::vector<uint32_t> &indices, const std::vector<int> &labels,
+			int cluster_count, const std::vector<Camera> &cameras, const std::vector<const uint8_t*> &masks);
+	void color(const std::vector<glm::vec4> &colors);
+
+	bool isEnabled() const
+	{
+		return m_step > 0;
+	}
+
+	const std::vector<SubVolume>& getSubVolumes() const
+	{
+		return m_volumes;
+	}
+
+	size_t getTestedVoxelCount() const
+	{
+		return m_tested_voxels;
+	}
+};
+} /* namespace nl_uu_science_gmt */
@@ -0,0 +1,119 @@
+#include "FootprintCarver.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include "BitOps.h"
+
+namespace nl_uu_science_gmt
+{
+
+// Candidates whose corners are projected in one batch
+constexpr size_t FOOTPRINT_BATCH = 512;
+
+FootprintCarver::FootprintCarver() :
+		m_camera_count(0),
+		m_entry_count(0)
+{
+}
+
+/**
+ * Project the 8 corners of every candidate on every camera and save their
+ * bounding boxes, clipped to the image
+ */
+void FootprintCarver::build(
+		const VoxelGrid &grid, const ProjectionLUT &lut, const std::vector<Camera> &cameras)
+{
+	m_camera_count = cameras.size();
+	m_entry_count = lut.getVoxelCount();
+	m_footprints.assign(m_camera_count * m_entry_count, Footprint { 0, 0, 0, 0 });
+
+	const uint32_t* voxel_indices = lut.getVoxelIndices();
+	const float half = grid.step * 0.5f;
+	const int64_t batches = (int64_t) ((m_entry_count + FOOTPRINT_BATCH - 1) / FOOTPRINT_BATCH);
+
+	int64_t b;
+#pragma omp parallel for schedule(static) private(b)
+	for (b = 0; b < batches; ++b)
+	{
+		const size_t first = (size_t) b * FOOTPRINT_BATCH;
+		const size_t last = std::min(first + FOOTPRINT_BATCH, m_entry_count);
+
+		std::vector<cv::Point3f> corners;
+		corners.reserve((last - first) * 8);
+		for (size_t e = first; e < last; ++e)
+		{
+			const cv::Point3i center = grid.coordinate(voxel_indices[e]);
+			for (int k = 0; k < 8; ++k)
+				corners.emplace_back(center.x + (k & 1 ? half : -half), center.y + (k & 2 ? half : -half),
+						center.z + (k & 4 ? half : -half));
+		}
+
+		std::vector<cv::Point2f> pixels(corners.size());
+		for (size_t c = 0; c < m_camera_count; ++c)
+		{
+			const cv::Size size = cameras[c].getSize();
+			cameras[c].projectOnView(corners.data(), corners.size(), pixels.data());
+			for (size_t e = first; e < last; ++e)
+			{
+				const cv::Point2f* p = pixels.data() + (e - first) * 8;
+				float x0 = p[0].x, y0 = p[0].y, x1 = p[0].x, y1 = p[0].y;
+				for (int k = 1; k < 8; ++k)
+				{
+					x0 = std::min(x0, p[k].x);
+					y0 = std::min(y0, p[k].y);
+					x1 = std::max(x1, p[k].x);
+					y1 = std::max(y1, p[k].y);
+				}
+
+				Footprint& footprint = m_footprints[c * m_entry_count + e];
+				// Pixel centers are at integer coordinates
+				footprint.x0 = (uint16_t) std::clamp((int) std::floor(x0 + 0.5f), 0, size.width - 1);
+				footprint.y0 = (uint16_t) std::clamp((int) std::floor(y0 + 0.5f), 0, size.height - 1);
+				footprint.x1 = (uint16_t) std::clamp((int) std::ceil(x1 - 0.5f), (int) footprint.x0, size.width - 1);
+				footprint.y1 = (uint16_t) std::clamp((int) std::ceil(y1 - 0.5f), (int) footprint.y0, size.height - 1);
+			}
+		}
+	}
+}
+
+/**
+ * Carve the 64 candidates of occupancy word 'word': bit i is set if at least
+ * 'fill_ratio' of candidate 64 * word + i's footprint is foreground on
+ * every camera
+ */
+uint64_t FootprintCarver::carveWord(
+		const std::vector<const cv::Mat*> &integrals, const ProjectionLUT &lut, size_t word, double fill_ratio) const
+{
+	assert(integrals.size() == m_camera_count);
+	// The padding after the last entry is never valid
+	uint64_t result = ~uint64_t(0);
+	for (size_t c = 0; c < m_camera_count; ++c)
+		result &= lut.getValidMask(c)[word];
+
+	const size_t first = word * 64;
+
+	BitOps::forEachBit(result, [&](int bit)
+	{
+		for (size_t c = 0; c < m_camera_count; ++c)
+		{
+			const Footprint& fp = m_footprints[c * m_entry_count + first + bit];
+			const cv::Mat& integral = *integrals[c];
+			const int* top = integral.ptr<int>(fp.y0);
+			const int* bottom = integral.ptr<int>(fp.y1 + 1);
+			const int sum = bottom[fp.x1 + 1] - top[fp.x1 + 1] - bottom[fp.x0] + top[fp.x0];
+			const int area = (fp.x1 - fp.x0 + 1) * (fp.y1 - fp.y0 + 1);
+
+			// Foreground pixels are 255
+			if (sum < fill_ratio * 255.0 * area)
+			{
+				result &= ~(uint64_t(1) << bit);
+				break;
+			}
+		}
+	});
+	return result;
+}
+
+} /* namespace nl_uu_science_gmt */
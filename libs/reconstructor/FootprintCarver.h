@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <opencv2/core/mat.hpp>
+
+#include "Camera.h"
+#include "ProjectionLUT.h"
+#include "Voxel.h"
+
+namespace nl_uu_science_gmt
+{
+/*
+ * Voxel carving against the whole projected voxel instead of its center
+ * For every candidate and camera the pixel bounding box of the voxel's 8
+ * projected corners is precomputed. Per frame the foreground fraction of
+ * each box is read from the camera's foreground integral image in four
+ * look ups, and a candidate is occupied if that fraction reaches the fill
+ * ratio on every camera. This covers the silhouettes without holes at
+ * steps where sampling the centers alone would alias.
+ */
+class FootprintCarver
+{
+	struct Footprint
+	{
+		uint16_t x0, y0, x1, y1;   // Inclusive pixel bounding box of the voxel's projection
+	};
+
+	size_t m_camera_count;
+	size_t m_entry_count;
+	std::vector<Footprint> m_footprints;   // Per camera, per look up table entry
+
+public:
+	FootprintCarver();
+
+	void build(const VoxelGrid &grid, const ProjectionLUT &lut, const std::vector<Camera> &cameras);
+	uint64_t carveWord(const std::vector<const cv::Mat*> &integrals, const ProjectionLUT &lut, size_t word,
+			double fill_ratio) const;
+
+	size_t getMemoryUsage() const
+	{
+		return m_footprints.capacity() * sizeof(Footprint);
+	}
+
+	bool empty() const
+	{
+		return m_footprints.empty();
+	}
+};
+} /* namespace nl_uu_science_gmt */
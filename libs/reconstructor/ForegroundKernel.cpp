@@ -0,0 +1,193 @@
+#include "ForegroundKernel.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define FOREGROUND_KERNEL_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(FOREGROUND_KERNEL_X86) && (defined(__GNUC__) || defined(__clang__))
+#define FOREGROUND_TARGET(isa) __attribute__((target(isa)))
+#else
+#define FOREGROUND_TARGET(isa)
+#endif
+
+namespace nl_uu_science_gmt
+{
+namespace ForegroundKernel
+{
+
+namespace
+{
+
+constexpr int HSV_SHIFT = 12;     // Fixed point shift of OpenCV's 8 bit HSV conversion
+constexpr int HUE_RANGE = 180;
+
+/*
+ * OpenCV's reciprocal tables of the 8 bit BGR to HSV conversion: saturation
+ * is diff * 255 / v and hue a sextant offset times 30 / diff, both rounded
+ * in fixed point
+ */
+struct DivisionTables
+{
+	int32_t saturation[256];
+	int32_t hue[256];
+
+	DivisionTables()
+	{
+		saturation[0] = hue[0] = 0;
+		for (int i = 1; i < 256; ++i)
+		{
+			saturation[i] = (int32_t) std::lround((255 << HSV_SHIFT) / (1.0 * i));
+			hue[i] = (int32_t) std::lround((HUE_RANGE << HSV_SHIFT) / (6.0 * i));
+		}
+	}
+};
+
+const DivisionTables& getTables()
+{
+	static const DivisionTables tables;
+	return tables;
+}
+
+inline int absoluteDifference(int a, int b)
+{
+	return a > b ? a - b : b - a;
+}
+
+void subtractScalar(const uint8_t* bgr, const uint8_t* const* background, Thresholds thresholds,
+		uint8_t* foreground, size_t count)
+{
+	const DivisionTables& tables = getTables();
+	for (size_t i = 0; i < count; ++i, bgr += 3)
+	{
+		const int b = bgr[0], g = bgr[1], r = bgr[2];
+		const int v = std::max(b, std::max(g, r));
+		const int diff = v - std::min(b, std::min(g, r));
+		const int s = (diff * tables.saturation[v] + (1 << (HSV_SHIFT - 1))) >> HSV_SHIFT;
+		int h = v == r ? g - b : v == g ? b - r + 2 * diff : r - g + 4 * diff;
+		h = (h * tables.hue[diff] + (1 << (HSV_SHIFT - 1))) >> HSV_SHIFT;
+		h += h < 0 ? HUE_RANGE : 0;
+
+		int dh = absoluteDifference(h, background[0][i]);
+		dh = std::min(dh, HUE_RANGE - dh);
+		const bool changed = (dh > thresholds.h && absoluteDifference(s, background[1][i]) > thresholds.s)
+				|| absoluteDifference(v, background[2][i]) > thresholds.v;
+		foreground[i] = changed ? 255 : 0;
+	}
+}
+
+#ifdef FOREGROUND_KERNEL_X86
+
+/*
+ * AVX2: 8 pixels per iteration in 32 bit lanes. The 24 BGR bytes are split
+ * into planes with two byte shuffles, the division table look ups are
+ * gathers and the arithmetic is the scalar kernel's, lane by lane.
+ */
+FOREGROUND_TARGET("avx2")
+void subtractAVX2(const uint8_t* bgr, const uint8_t* const* background, Thresholds thresholds,
+		uint8_t* foreground, size_t count)
+{
+	const DivisionTables& tables = getTables();
+	const __m128i low_b = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i high_b = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i low_g = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i high_g = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i low_r = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i high_r = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m256i round = _mm256_set1_epi32(1 << (HSV_SHIFT - 1));
+	const __m256i hue_range = _mm256_set1_epi32(HUE_RANGE);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i h_threshold = _mm256_set1_epi32(thresholds.h);
+	const __m256i s_threshold = _mm256_set1_epi32(thresholds.s);
+	const __m256i v_threshold = _mm256_set1_epi32(thresholds.v);
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		const uint8_t* pixels = bgr + i * 3;
+		const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels));
+		const __m128i high = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(pixels + 16));
+		const __m256i b = _mm256_cvtepu8_epi32(_mm_or_si128(_mm_shuffle_epi8(low, low_b), _mm_shuffle_epi8(high, high_b)));
+		const __m256i g = _mm256_cvtepu8_epi32(_mm_or_si128(_mm_shuffle_epi8(low, low_g), _mm_shuffle_epi8(high, high_g)));
+		const __m256i r = _mm256_cvtepu8_epi32(_mm_or_si128(_mm_shuffle_epi8(low, low_r), _mm_shuffle_epi8(high, high_r)));
+
+		const __m256i v = _mm256_max_epi32(b, _mm256_max_epi32(g, r));
+		const __m256i diff = _mm256_sub_epi32(v, _mm256_min_epi32(b, _mm256_min_epi32(g, r)));
+		const __m256i saturation = _mm256_i32gather_epi32(tables.saturation, v, 4);
+		const __m256i s = _mm256_srai_epi32(_mm256_add_epi32(_mm256_mullo_epi32(diff, saturation), round), HSV_SHIFT);
+
+		// Sextant offset: red is the maximum before green before blue
+		const __m256i h_red = _mm256_sub_epi32(g, b);
+		const __m256i h_green = _mm256_add_epi32(_mm256_sub_epi32(b, r), _mm256_add_epi32(diff, diff));
+		const __m256i h_blue = _mm256_add_epi32(_mm256_sub_epi32(r, g), _mm256_slli_epi32(diff, 2));
+		__m256i h = _mm256_blendv_epi8(h_blue, h_green, _mm256_cmpeq_epi32(v, g));
+		h = _mm256_blendv_epi8(h, h_red, _mm256_cmpeq_epi32(v, r));
+		const __m256i hue = _mm256_i32gather_epi32(tables.hue, diff, 4);
+		h = _mm256_srai_epi32(_mm256_add_epi32(_mm256_mullo_epi32(h, hue), round), HSV_SHIFT);
+		h = _mm256_add_epi32(h, _mm256_and_si256(_mm256_cmpgt_epi32(zero, h), hue_range));
+
+		const __m256i background_h = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(background[0] + i)));
+		const __m256i background_s = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(background[1] + i)));
+		const __m256i background_v = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(background[2] + i)));
+		__m256i dh = _mm256_abs_epi32(_mm256_sub_epi32(h, background_h));
+		dh = _mm256_min_epi32(dh, _mm256_sub_epi32(hue_range, dh));
+		const __m256i ds = _mm256_abs_epi32(_mm256_sub_epi32(s, background_s));
+		const __m256i dv = _mm256_abs_epi32(_mm256_sub_epi32(v, background_v));
+
+		const __m256i changed = _mm256_or_si256(
+				_mm256_and_si256(_mm256_cmpgt_epi32(dh, h_threshold), _mm256_cmpgt_epi32(ds, s_threshold)),
+				_mm256_cmpgt_epi32(dv, v_threshold));
+		const __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(changed), _mm256_extracti128_si256(changed, 1));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(foreground + i), _mm_packs_epi16(words, words));
+	}
+
+	const uint8_t* const tail[] = { background[0] + i, background[1] + i, background[2] + i };
+	subtractScalar(bgr + i * 3, tail, thresholds, foreground + i, count - i);
+}
+
+#endif
+
+}
+
+Function select(CarvingKernel::Isa isa)
+{
+#ifdef FOREGROUND_KERNEL_X86
+	if (isa == CarvingKernel::Isa::AVX2)
+		return subtractAVX2;
+#endif
+	return subtractScalar;
+}
+
+/**
+ * Write the foreground mask of the BGR image 'bgr' against the background
+ * HSV planes 'background' to 'foreground' (8 bit, 0 or 255), with the best
+ * kernel for this CPU
+ */
+void subtract(
+		const cv::Mat &bgr, const std::vector<cv::Mat> &background, Thresholds thresholds, cv::Mat &foreground)
+{
+	static const Function kernel = select(CarvingKernel::detect());
+	assert(bgr.type() == CV_8UC3 && background.size() == 3);
+	for (const auto& plane : background)
+		assert(plane.type() == CV_8U && plane.size() == bgr.size());
+
+	foreground.create(bgr.size(), CV_8U);
+	const bool continuous = bgr.isContinuous() && foreground.isContinuous() && background[0].isContinuous()
+			&& background[1].isContinuous() && background[2].isContinuous();
+	const int rows = continuous ? 1 : bgr.rows;
+	const size_t count = continuous ? bgr.total() : (size_t) bgr.cols;
+
+	for (int y = 0; y < rows; ++y)
+	{
+		const uint8_t* const planes[] = { background[0].ptr<uint8_t>(y), background[1].ptr<uint8_t>(y),
+				background[2].ptr<uint8_t>(y) };
+		kernel(bgr.ptr<uint8_t>(y), planes, thresholds, foreground.ptr<uint8_t>(y), count);
+	}
+}
+
+} /* namespace ForegroundKernel */
+} /* namespace nl_uu_science_gmt */
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <opencv2/core/mat.hpp>
+
+#include "CarvingKernel.h"
+
+namespace nl_uu_science_gmt
+{
+/*
+ * Fused HSV background subtraction
+ * Converts a BGR frame to HSV exactly like cvtColor(COLOR_BGR2HSV) does for
+ * 8 bit images (hue in [0, 180)), compares it to the background's HSV planes
+ * and writes the binary foreground mask in one pass, without temporary
+ * images. A pixel is foreground if both its hue and saturation differ more
+ * than their thresholds from the background, or its value does. Hue
+ * differences wrap around, 179 and 0 are 1 apart.
+ */
+namespace ForegroundKernel
+{
+
+struct Thresholds
+{
+	uint8_t h, s, v;
+};
+
+// Subtracts 'count' pixels: 'bgr' interleaved, 'background' the H, S and V planes
+using Function = void (*)(const uint8_t* bgr, const uint8_t* const* background, Thresholds thresholds,
+		uint8_t* foreground, size_t count);
+
+// Scalar or AVX2, there is no SSE4.1 kernel (the division tables need a gather)
+Function select(CarvingKernel::Isa isa);
+
+void subtract(const cv::Mat &bgr, const std::vector<cv::Mat> &background, Thresholds thresholds, cv::Mat &foreground);
+
+} /* namespace ForegroundKernel */
+} /* namespace nl_uu_science_gmt */
@@ -1,76 +1,211 @@
 #include "ForegroundOptimizer.h"
 #include <opencv2/imgproc/imgproc.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <limits>
+#include <utility>
+#include <vector>
 
 using nl_uu_science_gmt::ForegroundOptimizer;
 
-ForegroundOptimizer::ForegroundOptimizer(int nrContoursTracked)
-	: nrContoursTracked(nrContoursTracked)
+ForegroundOptimizer::ForegroundOptimizer(int nrComponentsKept)
+	: nrComponentsKept(nrComponentsKept)
 {
 }
 
-void ForegroundOptimizer::optimizeThresholds(int maxExtraContoursS, int maxExtraContoursV, const cv::Mat& h_image, const cv::Mat& s_image, const cv::Mat& v_image, std::vector<cv::Mat>& channels, uint8_t &h_threshold, uint8_t &s_threshold, uint8_t &v_threshold)
+namespace
 {
-	contours.clear();
-	int lastMergedContours_i = 255;
-	int lastNrContours = std::numeric_limits<int>::max() - 1000;
-	//optimize V
-	for (int i = 255; i > 5; i -= 5)
+//counts the contours findContours(RETR_TREE) would find while foreground pixels are added one by one:
+//8-connected blobs are tracked with union-find and the Euler number (blobs minus holes) with bit-quads.
+class ContourCounter
+{
+	int width;
+	int height;
+	std::vector<int32_t> parent; //-1 for background pixels
+	int components = 0;
+	int quadSum = 0; //4 times the Euler number
+
+	bool isForeground(int x, int y) const
 	{
-		cv::Mat foreground = runHSVThresholding(
-			h_image, s_image, v_image,
-			channels,
-			h_threshold, s_threshold, i
-		);
-		FindContours(foreground);
-		int currNrContours = contours.size();
-		if (currNrContours > lastNrContours + maxExtraContoursV)
+		return x >= 0 && y >= 0 && x < width && y < height && parent[y * width + x] >= 0;
+	}
+
+	//Gray's bit-quad weights for 8-connectivity: +1 for one pixel, -1 for three, -2 for a diagonal pair
+	int quadWeight(int x, int y) const
+	{
+		const int quad = isForeground(x, y) | isForeground(x + 1, y) << 1 | isForeground(x, y + 1) << 2 | isForeground(x + 1, y + 1) << 3;
+		static const int weights[16] = { 0, 1, 1, 0, 1, 0, -2, -1, 1, -2, 0, -1, 0, -1, -1, 0 };
+		return weights[quad];
+	}
+
+	int32_t find(int32_t p)
+	{
+		while (parent[p] != p)
 		{
-			v_threshold = lastMergedContours_i;
-			break;
+			parent[p] = parent[parent[p]];
+			p = parent[p];
 		}
-		else if (currNrContours < lastNrContours)
+		return p;
+	}
+
+public:
+	ContourCounter(int width, int height)
+		: width(width), height(height), parent((size_t)width * height, -1)
+	{
+	}
+
+	void add(int32_t p)
+	{
+		const int x = p % width;
+		const int y = p / width;
+		const int before = quadWeight(x - 1, y - 1) + quadWeight(x, y - 1) + quadWeight(x - 1, y) + quadWeight(x, y);
+		parent[p] = p;
+		quadSum += quadWeight(x - 1, y - 1) + quadWeight(x, y - 1) + quadWeight(x - 1, y) + quadWeight(x, y) - before;
+
+		components++;
+		for (int dy = -1; dy <= 1; dy++)
 		{
-			lastMergedContours_i = i;
+			for (int dx = -1; dx <= 1; dx++)
+			{
+				if ((dx != 0 || dy != 0) && isForeground(x + dx, y + dy))
+				{
+					const int32_t a = find(p);
+					const int32_t b = find((y + dy) * width + x + dx);
+					if (a != b)
+					{
+						parent[b] = a;
+						components--;
+					}
+				}
+			}
 		}
+	}
 
-		lastNrContours = currNrContours;
+	//outer contours plus hole contours
+	int count() const
+	{
+		return 2 * components - quadSum / 4;
+	}
+};
+
+//sweeps a threshold from 255 down in steps of 5, a pixel turning foreground once the threshold drops below its key (256 = always).
+//the pixels are bucketed by key once, so every step only adds the pixels that changed. returns the last threshold at which
+//contours merged before their count jumped by more than maxExtraContours, or 'threshold' if it never jumps.
+uint8_t sweepThreshold(const std::vector<uint16_t>& keys, int width, int height, int maxExtraContours, bool mergeOnEqual, uint8_t threshold)
+{
+	std::vector<int32_t> bucketStarts(258, 0);
+	for (uint16_t key : keys)
+	{
+		bucketStarts[key + 1]++;
+	}
+	for (int k = 0; k < 257; k++)
+	{
+		bucketStarts[k + 1] += bucketStarts[k];
+	}
+	std::vector<int32_t> order(keys.size());
+	std::vector<int32_t> fill(bucketStarts.begin(), bucketStarts.end() - 1);
+	for (int32_t p = 0; p < (int32_t)keys.size(); p++)
+	{
+		order[fill[keys[p]]++] = p;
 	}
 
-	contours.clear();
-	lastMergedContours_i = 255;
-	lastNrContours = std::numeric_limits<int>::max() - 1000;
-	//optimize S
+	ContourCounter counter(width, height);
+	int nextKey = 256;
+	int lastMergedContours_i = 255;
+	int lastNrContours = std::numeric_limits<int>::max() - 1000;
 	for (int i = 255; i > 5; i -= 5)
 	{
-		cv::Mat foreground = runHSVThresholding(
-			h_image, s_image, v_image,
-			channels,
-			h_threshold, i,	v_threshold
-		);
-		FindContours(foreground);
-		int currNrContours = contours.size();
-		if (currNrContours > lastNrContours + maxExtraContoursS)
+		for (; nextKey > i; nextKey--)
 		{
-			s_threshold = lastMergedContours_i;
-			break;
+			for (int32_t k = bucketStarts[nextKey]; k < bucketStarts[nextKey + 1]; k++)
+			{
+				counter.add(order[k]);
+			}
 		}
-		
-		else if (currNrContours <= lastNrContours)
+
+		int currNrContours = counter.count();
+		if (currNrContours > lastNrContours + maxExtraContours)
+		{
+			return (uint8_t)lastMergedContours_i;
+		}
+		else if (currNrContours < lastNrContours || (mergeOnEqual && currNrContours == lastNrContours))
 		{
 			lastMergedContours_i = i;
 		}
-	
+
 		lastNrContours = currNrContours;
 	}
-	
+	return threshold;
+}
+}
+
+//converts the frame to HSV and tunes this camera's S and V thresholds on it, the hue threshold stays as it is.
+void ForegroundOptimizer::calibrateThresholds(const cv::Mat& frame, const std::vector<cv::Mat>& background, int maxExtraContours)
+{
+	assert(background.size() == 3);
+	cv::Mat hsv_image;
+	cv::cvtColor(frame, hsv_image, cv::COLOR_BGR2HSV);
+	std::vector<cv::Mat> channels;
+	cv::split(hsv_image, channels);
+
+	sThreshold = 255;
+	vThreshold = 255;
+	optimizeThresholds(maxExtraContours, maxExtraContours, background[0], background[1], background[2], channels,
+		hThreshold, sThreshold, vThreshold);
+}
+
+//finds the V and then the S threshold at which the foreground stops merging into fewer contours and starts falling apart
+//into noise. the per pixel background differences are computed once and each sweep counts contours incrementally,
+//instead of thresholding and tracing contours at every step.
+void ForegroundOptimizer::optimizeThresholds(int maxExtraContoursS, int maxExtraContoursV, const cv::Mat& h_image, const cv::Mat& s_image, const cv::Mat& v_image, std::vector<cv::Mat>& channels, uint8_t &h_threshold, uint8_t &s_threshold, uint8_t &v_threshold)
+{
+	assert(h_image.isContinuous() && s_image.isContinuous() && v_image.isContinuous());
+	assert(channels[0].isContinuous() && channels[1].isContinuous() && channels[2].isContinuous());
+	const int width = h_image.cols;
+	const int height = h_image.rows;
+	const size_t nrPixels = h_image.total();
+	const uint8_t* h = channels[0].ptr<uint8_t>();
+	const uint8_t* s = channels[1].ptr<uint8_t>();
+	const uint8_t* v = channels[2].ptr<uint8_t>();
+	const uint8_t* bgH = h_image.ptr<uint8_t>();
+	const uint8_t* bgS = s_image.ptr<uint8_t>();
+	const uint8_t* bgV = v_image.ptr<uint8_t>();
+
+	//background differences, hue wrapping around at 180 like runHSVThresholding
+	std::vector<uint8_t> hueChanged(nrPixels), diffS(nrPixels), diffV(nrPixels);
+	for (size_t p = 0; p < nrPixels; p++)
+	{
+		const int dh = std::abs(h[p] - bgH[p]);
+		hueChanged[p] = std::min(dh, 180 - dh) > h_threshold;
+		diffS[p] = (uint8_t)std::abs(s[p] - bgS[p]);
+		diffV[p] = (uint8_t)std::abs(v[p] - bgV[p]);
+	}
+
+	//optimize V, the hue and saturation part of the mask stays fixed
+	std::vector<uint16_t> keys(nrPixels);
+	for (size_t p = 0; p < nrPixels; p++)
+	{
+		keys[p] = hueChanged[p] && diffS[p] > s_threshold ? 256 : diffV[p];
+	}
+	v_threshold = sweepThreshold(keys, width, height, maxExtraContoursV, false, v_threshold);
+
+	//optimize S, the value part of the mask stays fixed
+	for (size_t p = 0; p < nrPixels; p++)
+	{
+		keys[p] = diffV[p] > v_threshold ? 256 : hueChanged[p] ? diffS[p] : 0;
+	}
+	s_threshold = sweepThreshold(keys, width, height, maxExtraContoursS, true, s_threshold);
 }
 
 cv::Mat ForegroundOptimizer::runHSVThresholding(const cv::Mat& h_image, const cv::Mat& s_image, const cv::Mat& v_image, std::vector<cv::Mat>& channels, uint8_t h_threshold, uint8_t s_threshold, uint8_t v_threshold)
 {
 
-	// Background subtraction H
+	// Background subtraction H, hue wraps around at 180
 	cv::Mat tmp, foreground, background;
 	cv::absdiff(channels[0], h_image, tmp);
+	cv::subtract(cv::Scalar::all(180), tmp, background);
+	cv::min(tmp, background, tmp);
 	cv::threshold(tmp, foreground, h_threshold, 255, cv::THRESH_BINARY);
 
 	// Background subtraction S
@@ -86,75 +221,70 @@ cv::Mat ForegroundOptimizer::runHSVThresholding(const cv::Mat& h_image, const cv
 	return foreground;
 }
 
-void ForegroundOptimizer::saveMaxContour(double area, int contourIndex)
+//keeps the nrComponentsKept largest white blobs larger than removeWhiteComponentsSmallerThan pixels and fills
+//their holes of at most removeBlackComponentsSmallerThan pixels, writing the cleaned mask in place.
+//blobs are 8-connected and holes 4-connected, like the outer and hole contours of findContours.
+void ForegroundOptimizer::KeepMaxComponents(cv::Mat& mask, int removeWhiteComponentsSmallerThan, int removeBlackComponentsSmallerThan) const
 {
-	for (int i = 0; i != nrContoursTracked; i++)
+	assert(mask.type() == CV_8U);
+	cv::Mat labels, stats, centroids, holes;
+
+	//label the white blobs and keep the largest ones, the lowest label first among equal areas
+	int nrLabels = cv::connectedComponentsWithStats(mask, labels, stats, centroids, 8, CV_32S);
+	std::vector<std::pair<int, int>> components; //area and label of the blobs large enough
+	for (int i = 1; i < nrLabels; i++)
 	{
-		if (maxContourAreas[i] < area) //maxContours are sorted from high to low.
+		int area = stats.at<int>(i, cv::CC_STAT_AREA);
+		if (area > removeWhiteComponentsSmallerThan)
 		{
-			maxContourAreas.insert(maxContourAreas.begin() + i, area);
-			maxContourIndices.insert(maxContourIndices.begin() + i, contourIndex);
-			maxContourAreas.pop_back();
-			maxContourIndices.pop_back();
-			return;
+			components.emplace_back(area, i);
 		}
 	}
-}
-
-void ForegroundOptimizer::FindContours(const cv::Mat& thresholdedImg)
-{
-	cv::findContours(thresholdedImg, contours, hierarchy, cv::RETR_TREE, cv::CHAIN_APPROX_SIMPLE, cv::Point(0, 0));
-}
-
-//put 0 for removeContoursSmallerThan to not remove any contours
-void ForegroundOptimizer::SaveMaxContours( int removeWhiteContoursSmallerThan, int removeBlackContoursSmallerThan)
-{
-	maxContourAreas.clear();
-	maxContourAreas.resize(nrContoursTracked);
-	std::fill(maxContourAreas.begin(), maxContourAreas.end(), 0);
-	maxContourIndices.clear();
-	maxContourIndices.resize(nrContoursTracked);
-	blackContours.clear();
-	
-	for (int i = 0; i < contours.size(); i++)
-	{
-		double areaBlackPositive = contourArea(contours[i], true);
-		if (areaBlackPositive > removeBlackContoursSmallerThan)
-		{
-			blackContours.push_back(i); //save black contours to draw them over the white ones if they are large enough to not necessarily be noise.
-		}
-		double area = -areaBlackPositive; // negative means white apparently, and you want white
-		if (area > maxContourAreas[nrContoursTracked - 1] && area > removeWhiteContoursSmallerThan) 
+	const size_t kept = std::min(components.size(), (size_t) std::max(nrComponentsKept, 0));
+	std::partial_sort(components.begin(), components.begin() + kept, components.end(),
+		[](const std::pair<int, int>& a, const std::pair<int, int>& b)
 		{
-			saveMaxContour(area, i);
-		}
+			return a.first > b.first || (a.first == b.first && a.second < b.second);
+		});
 
+	std::vector<uint8_t> labelValues(nrLabels, 0); //new mask value per label
+	for (size_t i = 0; i < kept; i++)
+	{
+		labelValues[components[i].second] = 255;
 	}
-}
-
-void ForegroundOptimizer::DrawMaxContours(cv::Mat& image, bool removeBackground, cv::Scalar color)
-{
-	int nrMaxContours = maxContourIndices.size();
-	if (removeBackground)
+	for (int y = 0; y < mask.rows; y++)
 	{
-		image = cv::Mat::zeros(image.size(), image.type());
-		
-		for (int i = 0; i < nrMaxContours; i++)
+		uint8_t* row = mask.ptr<uint8_t>(y);
+		const int* rowLabels = labels.ptr<int>(y);
+		for (int x = 0; x < mask.cols; x++)
 		{
-			cv::drawContours(image, contours, maxContourIndices[i], color, cv::FILLED);
+			row[x] = labelValues[rowLabels[x]];
 		}
-		for (int i = 0; i < blackContours.size(); i++)
+	}
+
+	//label the black regions, those not touching the image border are holes in the kept blobs
+	cv::compare(mask, 0, holes, cv::CMP_EQ);
+	nrLabels = cv::connectedComponentsWithStats(holes, labels, stats, centroids, 4, CV_32S);
+	labelValues.assign(nrLabels, 0);
+	for (int i = 1; i < nrLabels; i++)
+	{
+		const int* stat = stats.ptr<int>(i);
+		bool touchesBorder = stat[cv::CC_STAT_LEFT] == 0 || stat[cv::CC_STAT_TOP] == 0
+			|| stat[cv::CC_STAT_LEFT] + stat[cv::CC_STAT_WIDTH] == mask.cols
+			|| stat[cv::CC_STAT_TOP] + stat[cv::CC_STAT_HEIGHT] == mask.rows;
+		if (!touchesBorder && stat[cv::CC_STAT_AREA] <= removeBlackComponentsSmallerThan)
 		{
-			cv::drawContours(image, contours, blackContours[i], cv::Scalar(0), cv::FILLED); //draw black contours over the white ones (holes between the legs, etc)
+			labelValues[i] = 255; //small holes are noise, fill them
 		}
 	}
-	else
+	for (int y = 0; y < mask.rows; y++)
 	{
-		for (int i = 0; i < nrMaxContours; i++)
+		uint8_t* row = mask.ptr<uint8_t>(y);
+		const int* rowLabels = labels.ptr<int>(y);
+		for (int x = 0; x < mask.cols; x++)
 		{
-			cv::drawContours(image, contours, maxContourIndices[i], color, cv::FILLED);
+			row[x] |= labelValues[rowLabels[x]];
 		}
 	}
-
-	
 }
+
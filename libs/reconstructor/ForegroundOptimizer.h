@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <vector>
 #include <opencv2/core/mat.hpp>
 
@@ -6,26 +7,32 @@ namespace nl_uu_science_gmt
 {
 class ForegroundOptimizer
 {
-	//sorted from high to low
-	std::vector<double> maxContourAreas; //save the amount of max contours you can have
-	std::vector<int> maxContourIndices;
-	std::vector<int> blackContours;
-	int savedContoursCounter = 0;
-	int nrContoursTracked; //the number of contours tracked
+	int nrComponentsKept; //the number of blobs KeepMaxComponents keeps
 
-	std::vector<std::vector<cv::Point>> contours;
-	std::vector<cv::Vec4i> hierarchy; //not in use
-
-	void saveMaxContour(double area, int contourIndex);
+	//background subtraction thresholds of the camera this optimizer belongs to
+	uint8_t hThreshold = 0;
+	uint8_t sThreshold = 19;
+	uint8_t vThreshold = 48;
 
 public:
-	void FindContours(const cv::Mat& thresholdedImg);
-	void SaveMaxContours(int removeWhiteContoursSmallerThan = 40, int removeBlackContoursSmallerThan = 20);
-	//save the max nr contours (nrContoursTracked) which have the largest size.
-	void DrawMaxContours(cv::Mat& image, bool removeBackground = true, cv::Scalar color = 255);
+	//keep the max nr blobs (nrComponentsKept) which have the largest size and fill their small holes.
+	void KeepMaxComponents(cv::Mat& mask, int removeWhiteComponentsSmallerThan = 40, int removeBlackComponentsSmallerThan = 20) const;
+	//tunes sThreshold and vThreshold on a BGR frame against the background's HSV channels, starting from S and V all background.
+	void calibrateThresholds(const cv::Mat& frame, const std::vector<cv::Mat>& background, int maxExtraContours);
 	void optimizeThresholds(int maxExtraContoursS, int maxExtraContoursV, const cv::Mat& h_image, const cv::Mat& s_image, const cv::Mat& v_image, std::vector<cv::Mat>& channels, uint8_t &h_threshold, uint8_t &s_threshold, uint8_t &v_threshold);
 	cv::Mat runHSVThresholding(const cv::Mat & h_image, const cv::Mat & s_image, const cv::Mat & v_image, std::vector<cv::Mat>& channels, uint8_t h_threshold, uint8_t s_threshold, uint8_t v_threshold);
-	explicit ForegroundOptimizer(int nrContoursTracked);
+	explicit ForegroundOptimizer(int nrComponentsKept);
+
+	uint8_t getHThreshold() const { return hThreshold; }
+	uint8_t getSThreshold() const { return sThreshold; }
+	uint8_t getVThreshold() const { return vThreshold; }
+
+	void setThresholds(uint8_t h, uint8_t s, uint8_t v)
+	{
+		hThreshold = h;
+		sThreshold = s;
+		vThreshold = v;
+	}
 
 };
 } /* namespace nl_uu_science_gmt */
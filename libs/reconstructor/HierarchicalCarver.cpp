@@ -0,0 +1,233 @@
+#include "HierarchicalCarver.h"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+#include "BitOps.h"
+
+namespace nl_uu_science_gmt
+{
+
+HierarchicalCarver::HierarchicalCarver() :
+		m_camera_count(0),
+		m_tested_cells(0),
+		m_tested_voxels(0)
+{
+}
+
+/**
+ * Sort the look up table entries in octree order and precompute the cell
+ * ranges and projection footprints, from leaf cells of leaf_size voxels up
+ * to level_count - 1 times coarser cells. Entries that aren't visible on
+ * every camera can never be occupied and are left out.
+ */
+void HierarchicalCarver::build(
+		const VoxelGrid &grid, const ProjectionLUT &lut, const cv::Size &plane_size, int leaf_size, int level_count)
+{
+	assert(leaf_size > 0 && level_count > 0 && level_count <= 8);
+	m_camera_count = lut.getCameraCount();
+	m_levels.assign(level_count, Level());
+
+	for (int l = 0; l < level_count; ++l)
+	{
+		Level& level = m_levels[l];
+		level.size = leaf_size << (level_count - 1 - l);
+		for (int d = 0; d < 3; ++d)
+			level.cells[d] = (grid.dimension[d] + level.size - 1) / level.size;
+		const size_t cells = (size_t) level.cells[0] * level.cells[1] * level.cells[2];
+		level.ranges.assign(cells, Range { 0, 0 });
+		level.footprints.assign(m_camera_count, std::vector<Footprint>(cells));
+	}
+
+	auto leafOf = [&grid, leaf_size](uint32_t voxel)
+	{
+		const cv::Vec3i p = grid.position(voxel);
+		return cv::Vec3i(p[0] / leaf_size, p[1] / leaf_size, p[2] / leaf_size);
+	};
+
+	// Octree key of every entry: its top cell, followed by 3 bits per finer level
+	const Level& top = m_levels.front();
+	const uint32_t* voxel_indices = lut.getVoxelIndices();
+	std::vector<std::pair<uint64_t, uint32_t>> keys;
+	keys.reserve(lut.getVoxelCount());
+	for (size_t e = 0; e < lut.getVoxelCount(); ++e)
+	{
+		bool visible = true;
+		for (size_t c = 0; c < m_camera_count && visible; ++c)
+			visible = lut.isValid(c, e);
+		if (!visible)
+			continue;
+
+		const cv::Vec3i leaf = leafOf(voxel_indices[e]);
+		const int shift = level_count - 1;
+		uint64_t key = ((uint64_t) (leaf[2] >> shift) * top.cells[1] + (leaf[1] >> shift)) * top.cells[0] + (leaf[0] >> shift);
+		for (int s = shift - 1; s >= 0; --s)
+			key = key << 3 | ((leaf[0] >> s) & 1) | (((leaf[1] >> s) & 1) << 1) | (((leaf[2] >> s) & 1) << 2);
+		keys.emplace_back(key, (uint32_t) e);
+	}
+	std::sort(keys.begin(), keys.end());
+
+	m_entries.resize(keys.size());
+	for (size_t i = 0; i < keys.size(); ++i)
+	{
+		const uint32_t e = keys[i].second;
+		m_entries[i] = e;
+
+		// The entries of a cell are contiguous, extend its range
+		const cv::Vec3i leaf = leafOf(voxel_indices[e]);
+		for (int l = 0; l < level_count; ++l)
+		{
+			Level& level = m_levels[l];
+			const int shift = level_count - 1 - l;
+			const size_t cell = ((size_t) (leaf[2] >> shift) * level.cells[1] + (leaf[1] >> shift)) * level.cells[0] + (leaf[0] >> shift);
+			Range& range = level.ranges[cell];
+			if (range.first == range.last)
+				range.first = (uint32_t) i;
+			range.last = (uint32_t) i + 1;
+		}
+	}
+
+	// Bounding box of the projections of every cell's entries
+	for (Level& level : m_levels)
+	{
+		int64_t i;
+#pragma omp parallel for schedule(static) private(i)
+		for (i = 0; i < (int64_t) level.ranges.size(); ++i)
+		{
+			const Range& range = level.ranges[i];
+			for (size_t c = 0; c < m_camera_count; ++c)
+			{
+				const uint32_t* offsets = lut.getOffsets(c);
+				int x0 = plane_size.width, y0 = plane_size.height, x1 = 0, y1 = 0;
+				for (uint32_t r = range.first; r < range.last; ++r)
+				{
+					const int px = (int) (offsets[m_entries[r]] % plane_size.width);
+					const int py = (int) (offsets[m_entries[r]] / plane_size.width);
+					x0 = std::min(x0, px);
+					y0 = std::min(y0, py);
+					x1 = std::max(x1, px);
+					y1 = std::max(y1, py);
+				}
+				if (range.first == range.last)
+					x0 = y0 = 0;
+				level.footprints[c][i] = Footprint { (uint16_t) x0, (uint16_t) y0, (uint16_t) x1, (uint16_t) y1 };
+			}
+		}
+	}
+}
+
+/**
+ * Classify a cell with entries against the foreground integral images of all cameras
+ */
+HierarchicalCarver::Coverage HierarchicalCarver::testCell(
+		const Level &level, size_t cell, const std::vector<const cv::Mat*> &integrals) const
+{
+	bool full = true;
+	for (size_t c = 0; c < m_camera_count; ++c)
+	{
+		const Footprint& fp = level.footprints[c][cell];
+		const cv::Mat& integral = *integrals[c];
+		const int sum = integral.at<int>(fp.y1 + 1, fp.x1 + 1) - integral.at<int>(fp.y0, fp.x1 + 1)
+				- integral.at<int>(fp.y1 + 1, fp.x0) + integral.at<int>(fp.y0, fp.x0);
+		if (sum == 0)
+			return EMPTY;
+
+		const int area = (fp.x1 - fp.x0 + 1) * (fp.y1 - fp.y0 + 1);
+		full = full && sum == 255 * area;
+	}
+	return full ? FULL : PARTIAL;
+}
+
+/**
+ * Carve one cell, recursing into its children while it is partially occupied
+ */
+void HierarchicalCarver::carveCell(
+		size_t l, const cv::Vec3i &cell, const std::vector<const cv::Mat*> &integrals, const std::vector<const uint32_t*> &offsets,
+		const std::vector<const uint8_t*> &foregrounds, uint64_t* occupancy, size_t &tested_cells, size_t &tested_voxels) const
+{
+	const Level& level = m_levels[l];
+	const size_t index = ((size_t) cell[2] * level.cells[1] + cell[1]) * level.cells[0] + cell[0];
+	const Range& range = level.ranges[index];
+	if (range.first == range.last)
+		return;  // No candidates in this cell
+
+	++tested_cells;
+	const Coverage coverage = testCell(level, index, integrals);
+	if (coverage == EMPTY)
+		return;
+
+	if (coverage == FULL)
+	{
+		BitOps::BitWriter writer(occupancy);
+		for (uint32_t r = range.first; r < range.last; ++r)
+			writer.set(m_entries[r]);
+	}
+	else if (l + 1 < m_levels.size())
+	{
+		const Level& fine = m_levels[l + 1];
+		for (int child = 0; child < 8; ++child)
+		{
+			const cv::Vec3i sub(cell[0] * 2 + (child & 1), cell[1] * 2 + ((child >> 1) & 1), cell[2] * 2 + (child >> 2));
+			if (sub[0] < fine.cells[0] && sub[1] < fine.cells[1] && sub[2] < fine.cells[2])
+				carveCell(l + 1, sub, integrals, offsets, foregrounds, occupancy, tested_cells, tested_voxels);
+		}
+	}
+	else
+	{
+		// Partially occupied leaf cell, test its candidates one by one
+		BitOps::BitWriter writer(occupancy);
+		for (uint32_t r = range.first; r < range.last; ++r)
+		{
+			const uint32_t e = m_entries[r];
+			bool visible = true;
+			for (size_t c = 0; c < m_camera_count && visible; ++c)
+				visible = foregrounds[c][offsets[c][e]] == 255;
+			if (visible)
+				writer.set(e);
+		}
+		tested_voxels += range.last - range.first;
+	}
+}
+
+/**
+ * Carve all entries into 'occupancy', which must be cleared beforehand
+ */
+void HierarchicalCarver::carve(
+		const std::vector<const cv::Mat*> &integrals, const std::vector<const uint32_t*> &offsets,
+		const std::vector<const uint8_t*> &foregrounds, std::vector<uint64_t> &occupancy)
+{
+	assert(!m_levels.empty() && integrals.size() == m_camera_count);
+	const Level& top = m_levels.front();
+	const int64_t cells = (int64_t) top.cells[0] * top.cells[1] * top.cells[2];
+
+	size_t tested_cells = 0, tested_voxels = 0;
+	int64_t i;
+#pragma omp parallel for schedule(dynamic) private(i) reduction(+:tested_cells, tested_voxels)
+	for (i = 0; i < cells; ++i)
+	{
+		const cv::Vec3i cell((int) (i % top.cells[0]), (int) ((i / top.cells[0]) % top.cells[1]),
+				(int) (i / ((int64_t) top.cells[0] * top.cells[1])));
+		carveCell(0, cell, integrals, offsets, foregrounds, occupancy.data(), tested_cells, tested_voxels);
+	}
+
+	m_tested_cells = tested_cells;
+	m_tested_voxels = tested_voxels;
+}
+
+/**
+ * Heap memory used by the entry order, cell ranges and footprints in bytes
+ */
+size_t HierarchicalCarver::getMemoryUsage() const
+{
+	size_t bytes = m_entries.capacity() * sizeof(uint32_t);
+	for (const Level& level : m_levels)
+	{
+		bytes += level.ranges.capacity() * sizeof(Range);
+		for (const auto& footprints : level.footprints)
+			bytes += footprints.capacity() * sizeof(Footprint);
+	}
+	return bytes;
+}
+
+} /* namespace nl_uu_science_gmt */
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <opencv2/core/mat.hpp>
+
+#include "ProjectionLUT.h"
+#include "Voxel.h"
+
+namespace nl_uu_science_gmt
+{
+/*
+ * Coarse-to-fine voxel carving
+ * The volume is split into cubic cells which are refined octree-style down to
+ * a leaf size. The look up table entries (candidate voxels) are sorted in
+ * octree order, so every cell on every level owns a contiguous range of
+ * them. For every cell and camera the pixel bounding box of its candidates'
+ * projections is precomputed. Per frame a cell is tested against each
+ * camera's foreground integral image: if the box holds no foreground on some
+ * camera the whole cell is empty, if it is completely foreground on every
+ * camera all its candidates are occupied, otherwise it is subdivided. Only
+ * the candidates of partially occupied leaf cells are tested one by one,
+ * which gives exactly the same occupancy as testing every candidate.
+ */
+class HierarchicalCarver
+{
+	struct Footprint
+	{
+		uint16_t x0, y0, x1, y1;   // Inclusive pixel bounding box of the cell's candidate projections
+	};
+
+	struct Range
+	{
+		uint32_t first, last;      // The cell's entries are m_entries[first, last)
+	};
+
+	struct Level
+	{
+		int size;                                  // Cell edge in voxels
+		cv::Vec3i cells;                           // Cell count in each dimension
+		std::vector<Range> ranges;                 // Per cell
+		std::vector<std::vector<Footprint>> footprints;   // Per camera, per cell
+	};
+
+	size_t m_camera_count;
+	std::vector<uint32_t> m_entries;               // Look up table entries in octree order
+	std::vector<Level> m_levels;                   // Coarsest level first, leaf level last
+
+	// Per-frame statistics
+	size_t m_tested_cells;
+	size_t m_tested_voxels;
+
+	enum Coverage
+	{
+		EMPTY,
+		FULL,
+		PARTIAL
+	};
+
+	Coverage testCell(const Level &level, size_t cell, const std::vector<const cv::Mat*> &integrals) const;
+	void carveCell(size_t level, const cv::Vec3i &cell, const std::vector<const cv::Mat*> &integrals,
+			const std::vector<const uint32_t*> &offsets, const std::vector<const uint8_t*> &foregrounds, uint64_t* occupancy,
+			size_t &tested_cells, size_t &tested_voxels) const;
+
+public:
+	HierarchicalCarver();
+
+	void build(const VoxelGrid &grid, const ProjectionLUT &lut, const cv::Size &plane_size, int leaf_size, int level_count);
+	void carve(const std::vector<const cv::Mat*> &integrals, const std::vector<const uint32_t*> &offsets,
+			const std::vector<const uint8_t*> &foregrounds, std::vector<uint64_t> &occupancy);
+
+	size_t getMemoryUsage() const;
+
+	bool empty() const
+	{
+		return m_levels.empty();
+	}
+
+	size_t getTestedCells() const
+	{
+		return m_tested_cells;
+	}
+
+	size_t getTestedVoxels() const
+	{
+		return m_tested_voxels;
+	}
+};
+} /* namespace nl_uu_science_gmt */
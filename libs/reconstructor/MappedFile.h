@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+namespace nl_uu_science_gmt
+{
+/*
+ * Read-only memory mapping of a whole file
+ * The mapping lives as long as the object, pages are loaded by the OS on
+ * first access instead of being copied up front.
+ */
+class MappedFile
+{
+	const void* m_data;     // Start of the mapping, page aligned
+	size_t m_size;          // Size of the mapping in bytes
+#ifdef _WIN32
+	void* m_file;           // File handle
+	void* m_mapping;        // File mapping handle
+#endif
+
+public:
+	MappedFile();
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const std::filesystem::path &file);
+	void close();
+
+	bool isOpen() const
+	{
+		return m_data != nullptr;
+	}
+
+	const void* data() const
+	{
+		return m_data;
+	}
+
+	size_t size() const
+	{
+		return m_size;
+	}
+};
+} /* namespace nl_uu_science_gmt */
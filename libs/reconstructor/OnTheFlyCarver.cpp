@@ -0,0 +1,172 @@
+#include "OnTheFlyCarver.h"
+
+#include <cassert>
+#include <cmath>
+
+#include "BitOps.h"
+
+namespace nl_uu_science_gmt
+{
+
+namespace
+{
+
+/*
+ * Homogeneous image point of a voxel, moved along the voxel row by adding
+ * the projection of one voxel step in x
+ */
+struct RowStepper
+{
+	const double* m;          // 3x4 projection matrix
+	double dx, dy, dz;        // Projection of one voxel step along x
+	double hx, hy, hz;        // Homogeneous image point of the current voxel
+
+	RowStepper(const double* matrix, int step) :
+			m(matrix),
+			dx(matrix[0] * step),
+			dy(matrix[4] * step),
+			dz(matrix[8] * step),
+			hx(0),
+			hy(0),
+			hz(0)
+	{
+	}
+
+	void start(const cv::Point3i &coordinate)
+	{
+		const double X = coordinate.x, Y = coordinate.y, Z = coordinate.z;
+		hx = m[0] * X + m[1] * Y + m[2] * Z + m[3];
+		hy = m[4] * X + m[5] * Y + m[6] * Z + m[7];
+		hz = m[8] * X + m[9] * Y + m[10] * Z + m[11];
+	}
+
+	void advance(int steps)
+	{
+		if (steps == 1)
+		{
+			hx += dx;
+			hy += dy;
+			hz += dz;
+		}
+		else
+		{
+			hx += dx * steps;
+			hy += dy * steps;
+			hz += dz * steps;
+		}
+	}
+
+	// Linear pixel offset of the current voxel, or -1 outside the image or behind the camera
+	int64_t offset(const cv::Size &size) const
+	{
+		if (hz <= 0)
+			return -1;
+		const double inverse = 1.0 / hz;
+		const int u = (int) std::lround(hx * inverse);
+		const int v = (int) std::lround(hy * inverse);
+		if (u < 0 || u >= size.width || v < 0 || v >= size.height)
+			return -1;
+		return (int64_t) v * size.width + u;
+	}
+};
+
+}
+
+OnTheFlyCarver::OnTheFlyCarver()
+{
+}
+
+/**
+ * Save the grid and every camera's undistorted projection matrix
+ */
+void OnTheFlyCarver::build(
+		const VoxelGrid &grid, const std::vector<Camera> &cameras)
+{
+	m_grid = grid;
+	m_plane_size = cameras.empty() ? cv::Size() : cameras.front().getSize();
+	m_projections.resize(cameras.size());
+	for (size_t c = 0; c < cameras.size(); ++c)
+	{
+		assert(cameras[c].getSize() == m_plane_size);
+		const double* pinhole = cameras[c].getPinholeProjection();
+		std::copy(pinhole, pinhole + 12, m_projections[c].begin());
+	}
+}
+
+/**
+ * List the voxels that project inside every camera's image, in ascending order
+ */
+void OnTheFlyCarver::findCandidates(
+		std::vector<uint32_t> &candidates) const
+{
+	const int rows = m_grid.dimension[1] * m_grid.dimension[2];
+	std::vector<std::vector<uint32_t>> row_candidates(rows);
+
+	int r;
+#pragma omp parallel for schedule(static) private(r)
+	for (r = 0; r < rows; ++r)
+	{
+		const uint32_t first = (uint32_t) r * m_grid.dimension[0];
+		std::vector<uint8_t> visible(m_grid.dimension[0], 1);
+		for (const auto& projection : m_projections)
+		{
+			RowStepper stepper(projection.data(), m_grid.step);
+			stepper.start(m_grid.coordinate(first));
+			for (int x = 0; x < m_grid.dimension[0]; ++x, stepper.advance(1))
+				visible[x] &= stepper.offset(m_plane_size) >= 0;
+		}
+
+		for (int x = 0; x < m_grid.dimension[0]; ++x)
+			if (visible[x])
+				row_candidates[r].push_back(first + x);
+	}
+
+	candidates.clear();
+	for (const auto& row : row_candidates)
+		candidates.insert(candidates.end(), row.begin(), row.end());
+}
+
+/**
+ * Carve up to 64 voxels against the undistorted foreground masks, bit i is
+ * set if voxels[i] is foreground on every camera. Consecutive voxels on the
+ * same row step the projection instead of starting over.
+ */
+uint64_t OnTheFlyCarver::carveWord(
+		const uint32_t* voxels, size_t count, const std::vector<const uint8_t*> &masks) const
+{
+	assert(count <= 64 && masks.size() == m_projections.size());
+	uint64_t word = count == 64 ? ~uint64_t(0) : (uint64_t(1) << count) - 1;
+	const uint32_t width = (uint32_t) m_grid.dimension[0];
+
+	for (size_t c = 0; c < m_projections.size() && word; ++c)
+	{
+		RowStepper stepper(m_projections[c].data(), m_grid.step);
+		const uint8_t* mask = masks[c];
+		uint32_t row = UINT32_MAX, x = 0;
+
+		uint64_t present = 0;
+		BitOps::forEachBit(word, [&](int bit)
+		{
+			const uint32_t v = voxels[bit];
+			const uint32_t voxel_row = v / width;
+			const uint32_t voxel_x = v - voxel_row * width;
+
+			// Step along the row, only start over on a new row
+			if (voxel_row == row)
+				stepper.advance((int) (voxel_x - x));
+			else
+				stepper.start(m_grid.coordinate(v));
+			row = voxel_row;
+			x = voxel_x;
+
+			const int64_t offset = stepper.offset(m_plane_size);
+			if (offset >= 0 && mask[offset] == 255)
+				present |= uint64_t(1) << bit;
+		});
+		word = present;
+	}
+
+	return word;
+}
+
+} /* namespace nl_uu_science_gmt */
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <opencv2/core/types.hpp>
+
+#include "Camera.h"
+#include "Voxel.h"
+
+namespace nl_uu_science_gmt
+{
+/*
+ * Voxel carving without a projection look up table
+ * Every camera is modelled as a pinhole camera looking at its undistorted
+ * foreground image, so a voxel's pixel is a 3x4 matrix product followed by
+ * a division. Along a row of voxels the homogeneous image point changes by
+ * a constant vector, so consecutive voxels only cost three additions before
+ * the division. Only the projection matrices are stored, which lets fine
+ * grids run in a fraction of the LUT's memory.
+ */
+class OnTheFlyCarver
+{
+	VoxelGrid m_grid;
+	cv::Size m_plane_size;
+	std::vector<std::array<double, 12>> m_projections;   // Per camera K [R|t] of the undistorted image
+
+public:
+	OnTheFlyCarver();
+
+	void build(const VoxelGrid &grid, const std::vector<Camera> &cameras);
+	void findCandidates(std::vector<uint32_t> &candidates) const;
+	uint64_t carveWord(const uint32_t* voxels, size_t count, const std::vector<const uint8_t*> &masks) const;
+
+	bool empty() const
+	{
+		return m_projections.empty();
+	}
+};
+} /* namespace nl_uu_science_gmt */
@@ -0,0 +1,60 @@
+#include "PixelVoxelIndex.h"
+
+namespace nl_uu_science_gmt
+{
+
+PixelVoxelIndex::PixelVoxelIndex() :
+		m_pixel_count(0)
+{
+}
+
+/**
+ * Invert the look up table with a counting sort per camera, so the voxels of
+ * every pixel end up in ascending index order
+ */
+void PixelVoxelIndex::build(
+		const ProjectionLUT &lut, size_t pixel_count)
+{
+	const size_t cameras = lut.getCameraCount();
+	m_pixel_count = pixel_count;
+	m_starts.assign(cameras, std::vector<uint32_t>());
+	m_voxels.assign(cameras, std::vector<uint32_t>());
+
+	int c;
+#pragma omp parallel for schedule(static) private(c)
+	for (c = 0; c < (int) cameras; ++c)
+	{
+		const uint32_t* offsets = lut.getOffsets(c);
+		std::vector<uint32_t>& starts = m_starts[c];
+		std::vector<uint32_t>& voxels = m_voxels[c];
+
+		// Count the voxels per pixel, shifted by one for the prefix sum
+		starts.assign(pixel_count + 1, 0);
+		for (size_t v = 0; v < lut.getVoxelCount(); ++v)
+			if (lut.isValid(c, v))
+				++starts[offsets[v] + 1];
+
+		for (size_t p = 0; p < pixel_count; ++p)
+			starts[p + 1] += starts[p];
+
+		// Scatter, using a moving cursor per pixel
+		voxels.resize(starts[pixel_count]);
+		std::vector<uint32_t> cursor(starts.begin(), starts.end() - 1);
+		for (size_t v = 0; v < lut.getVoxelCount(); ++v)
+			if (lut.isValid(c, v))
+				voxels[cursor[offsets[v]]++] = (uint32_t) v;
+	}
+}
+
+/**
+ * Heap memory used by the index in bytes
+ */
+size_t PixelVoxelIndex::getMemoryUsage() const
+{
+	size_t bytes = 0;
+	for (size_t c = 0; c < m_starts.size(); ++c)
+		bytes += (m_starts[c].capacity() + m_voxels[c].capacity()) * sizeof(uint32_t);
+	return bytes;
+}
+
+} /* namespace nl_uu_science_gmt */
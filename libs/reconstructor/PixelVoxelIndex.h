@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ProjectionLUT.h"
+
+namespace nl_uu_science_gmt
+{
+/*
+ * Inverse of the projection look up table
+ * For every camera a compressed row table (CSR) which lists, per image
+ * pixel, all look up table entries (candidate voxels) whose valid
+ * projection lands on that pixel.
+ */
+class PixelVoxelIndex
+{
+	size_t m_pixel_count;                           // Pixels per camera image
+	std::vector<std::vector<uint32_t>> m_starts;    // Per camera: first entry in m_voxels of each pixel (pixel_count + 1)
+	std::vector<std::vector<uint32_t>> m_voxels;    // Per camera: voxel indices grouped by pixel
+
+public:
+	PixelVoxelIndex();
+
+	void build(const ProjectionLUT &lut, size_t pixel_count);
+	size_t getMemoryUsage() const;
+
+	bool empty() const
+	{
+		return m_starts.empty();
+	}
+
+	size_t getPixelCount() const
+	{
+		return m_pixel_count;
+	}
+
+	// Voxels projecting onto 'pixel' of 'camera' are [begin, end)
+	const uint32_t* begin(size_t camera, uint32_t pixel) const
+	{
+		return m_voxels[camera].data() + m_starts[camera][pixel];
+	}
+
+	const uint32_t* end(size_t camera, uint32_t pixel) const
+	{
+		return m_voxels[camera].data() + m_starts[camera][pixel + 1];
+	}
+};
+} /* namespace nl_uu_science_gmt */
@@ -0,0 +1,250 @@
+#include "ProjectionLUT.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <system_error>
+
+namespace nl_uu_science_gmt
+{
+
+namespace
+{
+// Pad every camera row to whole 64 voxel words, so the carving kernels can
+// always read a full word of offsets
+constexpr size_t OFFSETS_PER_WORD = 64;
+
+// Cache file layout: a 64 byte header followed by the offsets, the validity
+// words and the voxel indices exactly as they are laid out in memory. Bump
+// the version whenever the layout or the meaning of the table changes.
+constexpr char CACHE_MAGIC[8] = { 'V', 'O', 'X', 'E', 'L', 'L', 'U', 'T' };
+constexpr uint32_t CACHE_VERSION = 2;
+constexpr uint32_t CACHE_BYTE_ORDER = 0x01020304;
+
+struct CacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t key;
+	uint64_t voxel_count;
+	uint64_t camera_count;
+	uint64_t stride;
+	uint64_t word_count;
+	uint64_t reserved;
+};
+static_assert(sizeof(CacheHeader) == 64, "The table data must stay 64 byte aligned in the cache file");
+}
+
+ProjectionLUT::ProjectionLUT() :
+		m_voxel_count(0),
+		m_camera_count(0),
+		m_stride(0),
+		m_word_count(0),
+		m_mapped_offsets(nullptr),
+		m_mapped_valid(nullptr),
+		m_mapped_voxel_indices(nullptr)
+{
+}
+
+ProjectionLUT::ProjectionLUT(
+		size_t voxel_count, size_t camera_count) :
+				m_voxel_count(voxel_count),
+				m_camera_count(camera_count),
+				m_stride((voxel_count + OFFSETS_PER_WORD - 1) / OFFSETS_PER_WORD * OFFSETS_PER_WORD),
+				m_word_count((voxel_count + 63) / 64),
+				m_mapped_offsets(nullptr),
+				m_mapped_valid(nullptr),
+				m_mapped_voxel_indices(nullptr)
+{
+	m_offsets.resize(m_stride * m_camera_count, INVALID_OFFSET);
+	m_valid.resize(m_word_count * m_camera_count, 0);
+
+	// Entry v is voxel v of the volume until told otherwise
+	m_voxel_indices.resize(m_voxel_count);
+	std::iota(m_voxel_indices.begin(), m_voxel_indices.end(), 0u);
+}
+
+/**
+ * Save the volume index of entry 'voxel'
+ */
+void ProjectionLUT::setVoxelIndex(
+		size_t voxel, uint32_t index)
+{
+	assert(voxel < m_voxel_count && !m_mapping);
+	m_voxel_indices[voxel] = index;
+}
+
+/**
+ * Save the pixel coordinates 'point' of the voxel projection on camera 'camera'.
+ * Safe to call concurrently for different voxels, the validity bits are only
+ * packed in finalize().
+ */
+void ProjectionLUT::setProjection(
+		size_t camera, size_t voxel, const cv::Point &point, const cv::Size &plane_size)
+{
+	assert(camera < m_camera_count && voxel < m_voxel_count && !m_mapping);
+
+	// Only projections within the camera's FoV get a pixel offset
+	if (point.x >= 0 && point.x < plane_size.width && point.y >= 0 && point.y < plane_size.height)
+		m_offsets[camera * m_stride + voxel] = (uint32_t) (point.y * plane_size.width + point.x);
+	else
+		m_offsets[camera * m_stride + voxel] = INVALID_OFFSET;
+}
+
+/**
+ * Copy the entries of the finalized table 'part' to entries [first, first +
+ * part's voxel count). Safe to call concurrently for disjoint ranges, the
+ * validity bits are only packed in finalize().
+ */
+void ProjectionLUT::setEntries(
+		size_t first, const ProjectionLUT &part)
+{
+	assert(part.m_camera_count == m_camera_count && first + part.m_voxel_count <= m_voxel_count && !m_mapping);
+
+	std::copy(part.getVoxelIndices(), part.getVoxelIndices() + part.m_voxel_count, m_voxel_indices.begin() + first);
+	for (size_t c = 0; c < m_camera_count; ++c)
+	{
+		const uint32_t* offsets = part.getOffsets(c);
+		for (size_t v = 0; v < part.m_voxel_count; ++v)
+			m_offsets[c * m_stride + first + v] = part.isValid(c, v) ? offsets[v] : INVALID_OFFSET;
+	}
+}
+
+/**
+ * Pack the validity bits and point every invalid offset at pixel 0, so that
+ * readers may load any offset unconditionally and mask the result afterwards
+ */
+void ProjectionLUT::finalize()
+{
+	assert(!m_mapping);
+
+	int64_t w;
+#pragma omp parallel for schedule(static) private(w)
+	for (w = 0; w < (int64_t) (m_word_count * m_camera_count); ++w)
+	{
+		const size_t camera = (size_t) w / m_word_count;
+		const size_t first = ((size_t) w % m_word_count) * 64;
+		uint32_t* offsets = m_offsets.data() + camera * m_stride;
+
+		uint64_t word = 0;
+		for (size_t v = first; v < first + 64 && v < m_voxel_count; ++v)
+		{
+			if (offsets[v] != INVALID_OFFSET)
+				word |= uint64_t(1) << (v - first);
+			else
+				offsets[v] = 0;
+		}
+		m_valid[w] = word;
+	}
+
+	// The padding is never valid, but must be safe to load as well
+	for (size_t c = 0; c < m_camera_count; ++c)
+		for (size_t v = m_voxel_count; v < m_stride; ++v)
+			m_offsets[c * m_stride + v] = 0;
+}
+
+/**
+ * Write the finalized table to 'file', tagged with 'key'. The file is
+ * written next to its destination first and then moved in place, so a
+ * process still mapping the old file is never affected.
+ */
+bool ProjectionLUT::save(
+		const std::filesystem::path &file, uint64_t key) const
+{
+	CacheHeader header {};
+	std::memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+	header.version = CACHE_VERSION;
+	header.byte_order = CACHE_BYTE_ORDER;
+	header.key = key;
+	header.voxel_count = m_voxel_count;
+	header.camera_count = m_camera_count;
+	header.stride = m_stride;
+	header.word_count = m_word_count;
+
+	std::filesystem::path temporary = file;
+	temporary += ".tmp";
+	{
+		std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+		if (!out)
+			return false;
+
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(getOffsets(0)), m_stride * m_camera_count * sizeof(uint32_t));
+		out.write(reinterpret_cast<const char*>(getValidMask(0)), m_word_count * m_camera_count * sizeof(uint64_t));
+		out.write(reinterpret_cast<const char*>(getVoxelIndices()), m_voxel_count * sizeof(uint32_t));
+		if (!out)
+			return false;
+	}
+
+	std::error_code error;
+	std::filesystem::rename(temporary, file, error);
+	if (error)
+	{
+		std::filesystem::remove(temporary, error);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Map the table from 'file', only if it was saved with the same 'key' and
+ * camera count by the same table version, otherwise leave this table as is
+ */
+bool ProjectionLUT::load(
+		const std::filesystem::path &file, uint64_t key, size_t camera_count)
+{
+	auto mapping = std::make_shared<MappedFile>();
+	if (!mapping->open(file) || mapping->size() < sizeof(CacheHeader))
+		return false;
+
+	CacheHeader header;
+	std::memcpy(&header, mapping->data(), sizeof(header));
+
+	const size_t voxel_count = (size_t) header.voxel_count;
+	const size_t stride = (voxel_count + OFFSETS_PER_WORD - 1) / OFFSETS_PER_WORD * OFFSETS_PER_WORD;
+	const size_t word_count = (voxel_count + 63) / 64;
+	const size_t offsets_size = stride * camera_count * sizeof(uint32_t);
+	const size_t valid_size = word_count * camera_count * sizeof(uint64_t);
+	const size_t indices_size = voxel_count * sizeof(uint32_t);
+
+	if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != CACHE_VERSION
+			|| header.byte_order != CACHE_BYTE_ORDER || header.key != key || header.camera_count != camera_count || header.stride != stride || header.word_count != word_count
+			|| mapping->size() != sizeof(CacheHeader) + offsets_size + valid_size + indices_size)
+		return false;
+
+	const char* data = static_cast<const char*>(mapping->data()) + sizeof(CacheHeader);
+
+	m_voxel_count = voxel_count;
+	m_camera_count = camera_count;
+	m_stride = stride;
+	m_word_count = word_count;
+	m_offsets.clear();
+	m_offsets.shrink_to_fit();
+	m_valid.clear();
+	m_valid.shrink_to_fit();
+	m_voxel_indices.clear();
+	m_voxel_indices.shrink_to_fit();
+	m_mapped_offsets = reinterpret_cast<const uint32_t*>(data);
+	m_mapped_valid = reinterpret_cast<const uint64_t*>(data + offsets_size);
+	m_mapped_voxel_indices = reinterpret_cast<const uint32_t*>(data + offsets_size + valid_size);
+	m_mapping = std::move(mapping);
+
+	return true;
+}
+
+/**
+ * Memory used by the table in bytes, either on the heap or mapped
+ */
+size_t ProjectionLUT::getMemoryUsage() const
+{
+	if (m_mapping)
+		return m_mapping->size() - sizeof(CacheHeader);
+	return m_offsets.capacity() * sizeof(uint32_t) + m_valid.capacity() * sizeof(uint64_t)
+			+ m_voxel_indices.capacity() * sizeof(uint32_t);
+}
+
+} /* namespace nl_uu_science_gmt */
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <vector>
+#include <opencv2/core/types.hpp>
+
+#include "AlignedAllocator.h"
+#include "MappedFile.h"
+
+namespace nl_uu_science_gmt
+{
+/*
+ * Voxel to pixel projection look up table
+ * Holds a list of voxels, normally only the candidates that are visible on
+ * every camera, together with their index in the volume. Stored camera-major
+ * as structure-of-arrays: for every camera one contiguous, cache line aligned
+ * row of linear pixel offsets (y * width + x) into that camera's foreground
+ * image, plus one validity bit per entry that flags whether the projection
+ * falls inside the camera's FoV.
+ * A finalized table can be saved to a binary cache file and later mapped
+ * straight from that file instead of being rebuilt.
+ */
+class ProjectionLUT
+{
+	size_t m_voxel_count;                                         // Entries (voxels) per camera row
+	size_t m_camera_count;                                        // Amount of camera rows
+	size_t m_stride;                                              // Padded row length of m_offsets
+	size_t m_word_count;                                          // 64 bit words per camera in m_valid
+
+	std::vector<uint32_t, AlignedAllocator<uint32_t>> m_offsets;  // Linear pixel offset of voxel v on camera c
+	std::vector<uint64_t, AlignedAllocator<uint64_t>> m_valid;    // Bit v set if voxel v projects inside camera c
+	std::vector<uint32_t> m_voxel_indices;                        // Volume index of entry v
+
+	std::shared_ptr<const MappedFile> m_mapping;                  // Cache file the table is read from, if any
+	const uint32_t* m_mapped_offsets;                             // m_offsets inside m_mapping
+	const uint64_t* m_mapped_valid;                               // m_valid inside m_mapping
+	const uint32_t* m_mapped_voxel_indices;                       // m_voxel_indices inside m_mapping
+
+public:
+	static constexpr uint32_t INVALID_OFFSET = UINT32_MAX;
+
+	ProjectionLUT();
+	ProjectionLUT(size_t voxel_count, size_t camera_count);
+
+	void setVoxelIndex(size_t voxel, uint32_t index);
+	void setProjection(size_t camera, size_t voxel, const cv::Point &point, const cv::Size &plane_size);
+	void setEntries(size_t first, const ProjectionLUT &part);
+	void finalize();
+
+	bool save(const std::filesystem::path &file, uint64_t key) const;
+	bool load(const std::filesystem::path &file, uint64_t key, size_t camera_count);
+
+	size_t getMemoryUsage() const;
+
+	size_t getVoxelCount() const
+	{
+		return m_voxel_count;
+	}
+
+	size_t getCameraCount() const
+	{
+		return m_camera_count;
+	}
+
+	size_t getWordCount() const
+	{
+		return m_word_count;
+	}
+
+	bool isMapped() const
+	{
+		return m_mapping != nullptr;
+	}
+
+	const uint32_t* getOffsets(size_t camera) const
+	{
+		return (m_mapping ? m_mapped_offsets : m_offsets.data()) + camera * m_stride;
+	}
+
+	const uint64_t* getValidMask(size_t camera) const
+	{
+		return (m_mapping ? m_mapped_valid : m_valid.data()) + camera * m_word_count;
+	}
+
+	// Volume index of every entry
+	const uint32_t* getVoxelIndices() const
+	{
+		return m_mapping ? m_mapped_voxel_indices : m_voxel_indices.data();
+	}
+
+	bool isValid(size_t camera, size_t voxel) const
+	{
+		return (getValidMask(camera)[voxel >> 6] >> (voxel & 63)) & 1u;
+	}
+};
+} /* namespace nl_uu_science_gmt */
@@ -0,0 +1,235 @@
+#include "ReconstructionConfig.h"
+
+#include <algorithm>
+#include <opencv2/core/persistence.hpp>
+
+namespace nl_uu_science_gmt
+{
+
+namespace
+{
+// GPU side sizes, see Renderer: an rgba32f 3D texture, and a vertex buffer
+// of up to 15 marching cubes vertices (position, normal, color) per voxel,
+// capped by the mesh budget
+constexpr size_t GPU_TEXEL_SIZE = 4 * sizeof(float);
+constexpr size_t GPU_VERTEX_SIZE = 3 * 4 * sizeof(float);
+constexpr size_t GPU_VERTICES_PER_VOXEL = 15;
+
+// Host scalar field, see BrickVolume: a table entry (pointer and flags) per 8^3 brick
+constexpr int BRICK_SIZE = 8;
+constexpr size_t BRICK_TABLE_ENTRY_SIZE = sizeof(void*) + sizeof(uint8_t);
+
+// Coarsest step fitMemoryBudget() falls back to
+constexpr int MAX_STEP = 256;
+
+constexpr size_t MB = 1024 * 1024;
+
+template<typename T>
+void readValue(const cv::FileNode &node, T &value)
+{
+	if (!node.empty())
+		node >> value;
+}
+
+void readBounds(const cv::FileStorage &fs, const char* min_key, const char* max_key, cv::Vec2i &bounds)
+{
+	readValue(fs[min_key], bounds[0]);
+	readValue(fs[max_key], bounds[1]);
+}
+
+void readBudget(const cv::FileNode &node, size_t &budget)
+{
+	int megabytes = -1;
+	readValue(node, megabytes);
+	if (megabytes >= 0)
+		budget = (size_t) megabytes * MB;
+}
+}
+
+ReconstructionConfig::ReconstructionConfig() :
+		x_bounds(-2048, 2048),
+		y_bounds(-2048, 2048),
+		z_bounds(0, 2048),
+		step(32),
+		camera_count(4),
+		cluster_count(4),
+		engine(CarvingEngine::LUT),
+		order(CandidateOrder::Linear),
+		projection(ProjectionModel::Distorted),
+		fill_ratio(0.5),
+		lazy_lut(false),
+		refine_step(0),
+		refine_padding(64),
+		seed_background(false),
+		lut_budget(2048 * MB),
+		scalar_field_budget(1024 * MB),
+		gpu_budget(2048 * MB),
+		mesh_budget(256 * MB)
+{
+}
+
+/**
+ * Override the settings found in the XML 'file', returns false (and keeps
+ * the current settings) if the file can't be opened or is inconsistent
+ */
+bool ReconstructionConfig::load(
+		const std::filesystem::path &file)
+{
+	cv::FileStorage fs;
+	if (!std::filesystem::exists(file) || !fs.open(file.u8string(), cv::FileStorage::READ))
+		return false;
+
+	ReconstructionConfig config = *this;
+	readBounds(fs, "XMin", "XMax", config.x_bounds);
+	readBounds(fs, "YMin", "YMax", config.y_bounds);
+	readBounds(fs, "ZMin", "ZMax", config.z_bounds);
+	readValue(fs["Step"], config.step);
+	readValue(fs["Cameras"], config.camera_count);
+	readValue(fs["Persons"], config.cluster_count);
+	std::string engine;
+	readValue(fs["Engine"], engine);
+	if (engine == "LUT")
+		config.engine = CarvingEngine::LUT;
+	else if (engine == "OnTheFly")
+		config.engine = CarvingEngine::OnTheFly;
+	else if (!engine.empty())
+		return false;
+
+	std::string order;
+	readValue(fs["CandidateOrder"], order);
+	if (order == "Linear")
+		config.order = CandidateOrder::Linear;
+	else if (order == "Morton")
+		config.order = CandidateOrder::Morton;
+	else if (!order.empty())
+		return false;
+
+	std::string projection;
+	readValue(fs["Projection"], projection);
+	if (projection == "Distorted")
+		config.projection = ProjectionModel::Distorted;
+	else if (projection == "Pinhole")
+		config.projection = ProjectionModel::Pinhole;
+	else if (!projection.empty())
+		return false;
+
+	readValue(fs["FootprintFillRatio"], config.fill_ratio);
+	readValue(fs["LazyLUT"], config.lazy_lut);
+	readValue(fs["RefineStep"], config.refine_step);
+	readValue(fs["RefinePadding"], config.refine_padding);
+	readValue(fs["SeedBackground"], config.seed_background);
+
+	readBudget(fs["LUTBudgetMB"], config.lut_budget);
+	readBudget(fs["ScalarFieldBudgetMB"], config.scalar_field_budget);
+	readBudget(fs["GPUBudgetMB"], config.gpu_budget);
+	readBudget(fs["MeshBudgetMB"], config.mesh_budget);
+	fs.release();
+
+	// The clusterer takes the amount of persons as 8 bit
+	if (config.step <= 0 || config.camera_count <= 0 || config.cluster_count <= 0 || config.cluster_count > UINT8_MAX
+			|| config.x_bounds[1] - config.x_bounds[0] < config.step
+			|| config.y_bounds[1] - config.y_bounds[0] < config.step
+			|| config.z_bounds[1] - config.z_bounds[0] < config.step
+			|| config.fill_ratio < 0.0 || config.fill_ratio > 1.0
+			|| config.refine_step < 0 || config.refine_padding < 0)
+		return false;
+
+	*this = config;
+	return true;
+}
+
+/**
+ * Voxel count in each dimension, voxels that would stick out of the
+ * bounds are left out
+ */
+cv::Vec3i ReconstructionConfig::getDimension() const
+{
+	return cv::Vec3i(
+			(x_bounds[1] - x_bounds[0]) / step,
+			(y_bounds[1] - y_bounds[0]) / step,
+			(z_bounds[1] - z_bounds[0]) / step);
+}
+
+size_t ReconstructionConfig::getVoxelCount() const
+{
+	const cv::Vec3i dimension = getDimension();
+	return (size_t) dimension[0] * dimension[1] * dimension[2];
+}
+
+/**
+ * Vertices the marching cubes buffer holds: up to 15 per voxel, capped by
+ * the mesh budget. The surface only crosses a small part of the volume, so
+ * fine grids don't need a buffer of the volume's size.
+ */
+size_t ReconstructionConfig::getMeshVertexCapacity() const
+{
+	const size_t capacity = getVoxelCount() * GPU_VERTICES_PER_VOXEL;
+	if (mesh_budget == 0)
+		return capacity;
+	// Whole triangles only
+	return std::min(capacity, mesh_budget / (3 * GPU_VERTEX_SIZE) * 3);
+}
+
+/**
+ * Projected memory use of the reconstruction with these settings, the LUT
+ * estimate is an upper bound as it assumes every voxel is a candidate. The
+ * on the fly engine only keeps the list of candidates. The scalar field
+ * estimate only covers its brick table, the bricks follow the occupied space.
+ * The GPU estimate is the dense 3D texture plus the capped mesh buffer.
+ */
+ReconstructionConfig::MemoryEstimate ReconstructionConfig::estimateMemory() const
+{
+	const size_t voxels = getVoxelCount();
+	const size_t words = (voxels + 63) / 64;
+
+	MemoryEstimate estimate;
+	estimate.lut = words * 64 * sizeof(uint32_t);
+	if (engine == CarvingEngine::LUT)
+		estimate.lut += (size_t) camera_count * (words * 64 * sizeof(uint32_t) + words * sizeof(uint64_t));
+	const cv::Vec3i dimension = getDimension();
+	size_t bricks = 1;
+	for (int d = 0; d < 3; ++d)
+		bricks *= (size_t) (dimension[d] + BRICK_SIZE - 1) / BRICK_SIZE;
+	estimate.scalar_field = bricks * BRICK_TABLE_ENTRY_SIZE;
+	estimate.gpu = voxels * GPU_TEXEL_SIZE + getMeshVertexCapacity() * GPU_VERTEX_SIZE;
+	return estimate;
+}
+
+/**
+ * Report the projected memory use and double the step until every budget
+ * is met. Returns false if even the coarsest step doesn't fit.
+ */
+bool ReconstructionConfig::fitMemoryBudget(
+		std::ostream &report)
+{
+	auto fits = [this](const MemoryEstimate &estimate)
+	{
+		return (lut_budget == 0 || estimate.lut <= lut_budget)
+				&& (scalar_field_budget == 0 || estimate.scalar_field <= scalar_field_budget)
+				&& (gpu_budget == 0 || estimate.gpu <= gpu_budget);
+	};
+
+	MemoryEstimate estimate = estimateMemory();
+	report << "Voxel step " << step << " mm: LUT " << estimate.lut / MB << " MB, scalar field "
+			<< estimate.scalar_field / MB << " MB, GPU " << estimate.gpu / MB << " MB" << std::endl;
+
+	auto can_coarsen = [this]()
+	{
+		const int coarser = step * 2;
+		return coarser <= MAX_STEP && x_bounds[1] - x_bounds[0] >= coarser && y_bounds[1] - y_bounds[0] >= coarser
+				&& z_bounds[1] - z_bounds[0] >= coarser;
+	};
+
+	while (!fits(estimate) && can_coarsen())
+	{
+		step *= 2;
+		estimate = estimateMemory();
+		report << "Over budget, falling back to voxel step " << step << " mm: LUT " << estimate.lut / MB
+				<< " MB, scalar field " << estimate.scalar_field / MB << " MB, GPU " << estimate.gpu / MB << " MB"
+				<< std::endl;
+	}
+
+	return fits(estimate);
+}
+
+} /* namespace nl_uu_science_gmt */
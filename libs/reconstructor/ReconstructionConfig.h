@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <string>
+#include <opencv2/core/types.hpp>
+
+namespace nl_uu_science_gmt
+{
+enum class CarvingEngine
+{
+	LUT,            // Look up every voxel's pixels in a precomputed projection table
+	OnTheFly        // Compute the pixels every frame, stepping the projection along voxel rows
+};
+
+enum class CandidateOrder
+{
+	Linear,         // Ascending volume index, x running fastest
+	Morton          // Z-order curve within slabs of z-layers, see VoxelOrder
+};
+
+enum class ProjectionModel
+{
+	Distorted,      // Project with the lens distortion onto the camera images
+	Pinhole         // Project without distortion onto the undistorted foreground images
+};
+
+/*
+ * Reconstruction settings
+ * Volume bounds per axis in mm ([min, max)), the voxel step, the amount of
+ * cameras and persons, and the memory budgets the reconstruction has to fit
+ * in. Defaults match the original 4x4x2 m half-space at 32 mm. All values
+ * can be overridden from an optional XML file.
+ */
+struct ReconstructionConfig
+{
+	cv::Vec2i x_bounds;                 // Volume extent along x (mm)
+	cv::Vec2i y_bounds;                 // Volume extent along y (mm)
+	cv::Vec2i z_bounds;                 // Volume extent along z, from the floor up (mm)
+	int step;                           // Step size (space between voxels)
+	int camera_count;                   // Amount of camera views
+	int cluster_count;                  // Amount of persons in the scene
+	CarvingEngine engine;               // How voxels are projected onto the cameras
+	CandidateOrder order;               // Storage order of the candidate voxels
+	ProjectionModel projection;         // How the LUT maps voxels onto the foreground images
+	double fill_ratio;                  // Footprint carving: min foreground fraction of a voxel's footprint
+	bool lazy_lut;                      // Build the LUT on a background thread, carving a preview meanwhile
+	int refine_step;                    // Step of the sub-volumes carved around each cluster, 0 = off
+	int refine_padding;                 // Margin around each cluster's bounding box (mm)
+	bool seed_background;               // Start the background models from background.png instead of the first video frame
+
+	size_t lut_budget;                  // Max bytes of the projection LUT, 0 = unlimited
+	size_t scalar_field_budget;         // Max bytes of the host side scalar field, 0 = unlimited
+	size_t gpu_budget;                  // Max bytes of the GPU scalar field and mesh buffers, 0 = unlimited
+	size_t mesh_budget;                 // Max bytes of the GPU marching cubes vertex buffer, 0 = unlimited
+
+	struct MemoryEstimate
+	{
+		size_t lut;
+		size_t scalar_field;
+		size_t gpu;
+	};
+
+	ReconstructionConfig();
+
+	bool load(const std::filesystem::path &file);
+
+	cv::Vec3i getDimension() const;
+	size_t getVoxelCount() const;
+	size_t getMeshVertexCapacity() const;
+	MemoryEstimate estimateMemory() const;
+	bool fitMemoryBudget(std::ostream &report);
+};
+} /* namespace nl_uu_science_gmt */
@@ -9,23 +9,76 @@
 
 #include <opencv2/core/mat.hpp>
 #include <opencv2/core/operations.hpp>
+#include <algorithm>
 #include <cassert>
 #include <iostream>
+#include <numeric>
+
+#include "BitOps.h"
+#include "VoxelOrder.h"
 
 using namespace cv;
 
 namespace nl_uu_science_gmt
 {
 
+// Occupancy words per block of the visible voxel compaction
+constexpr size_t COMPACTION_BLOCK_WORDS = 16;
+// Fall back to a full update once this fraction of all pixels changed
+constexpr double INCREMENTAL_MAX_CHANGE = 0.25;
+// Hierarchical carving: leaf cells of 4^3 voxels, refined from 16^3 voxel cells
+constexpr int HIERARCHY_LEAF_SIZE = 4;
+constexpr int HIERARCHY_LEVELS = 3;
+// Weight of the previous frames in the smoothed camera rejection rates
+constexpr double CAMERA_ORDER_SMOOTHING = 0.5;
+// Projection LUT cache, stored in the data directory next to the camera directories
+constexpr const char* LUT_CACHE_FILE = "voxels.lut";
+
+namespace
+{
+/**
+ * 64 bit FNV-1a hash of 'size' bytes, continuing from 'hash'
+ */
+uint64_t fnv1a(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325ull)
+{
+	const auto* bytes = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+uint64_t fnv1a(const Mat &matrix, uint64_t hash)
+{
+	const Mat values = matrix.isContinuous() ? matrix : matrix.clone();
+	const int type = values.type();
+	hash = fnv1a(&type, sizeof(type), hash);
+	return fnv1a(values.data, values.total() * values.elemSize(), hash);
+}
+}
+
 /**
  * Constructor
  * Voxel reconstruction class
  */
 Reconstructor::Reconstructor(
-		const std::vector<Camera> &cs) :
+		const std::vector<Camera> &cs, const ReconstructionConfig &config) :
 				m_cameras(cs),
-				m_height(2048),
-				m_step(32)
+				m_config(config),
+				m_lut_key(0),
+				m_lut_active(false),
+				m_lut_built(false),
+				m_cancel_build(false),
+				m_ready_slabs(0),
+				m_carving_isa(CarvingKernel::detect()),
+				m_carve(CarvingKernel::select(m_carving_isa, cs.size())),
+				m_occupancy_valid(false),
+				m_mode(CarvingMode::Dense),
+				m_refiner(config.refine_step, config.refine_padding),
+				m_tested_voxels(0),
+				m_adaptive_order(true)
 {
 	for (const auto& c : m_cameras)
 	{
@@ -35,34 +88,49 @@ Reconstructor::Reconstructor(
 			m_plane_size = c.getSize();
 	}
 
-	const size_t edge = 2 * m_height;
-	m_voxels_dimension = Vec3w(edge / m_step, edge / m_step, m_height / m_step);
-	m_voxels_amount = (edge / m_step) * (edge / m_step) * (m_height / m_step);
-	m_scalar_field.resize(m_voxels_amount, glm::vec4(0.0f, 0.0f, 0.0f, 0.0f));
+	assert(m_config.camera_count == (int) m_cameras.size());
+	if (!m_config.fitMemoryBudget(std::cout))
+		std::cerr << "Reconstruction exceeds its memory budget at the coarsest voxel step" << std::endl;
+
+	const Vec3i dimension = m_config.getDimension();
+	m_voxels_dimension = Vec3w((ushort) dimension[0], (ushort) dimension[1], (ushort) dimension[2]);
+	m_voxels_amount = m_config.getVoxelCount();
+	m_scalar_field.resize(dimension);
+	m_carved_generations.resize(m_cameras.size(), 0);
+	m_camera_order.resize(m_cameras.size());
+	std::iota(m_camera_order.begin(), m_camera_order.end(), 0);
+	m_rejection_rates.resize(m_cameras.size(), 0.0);
 
 	initialize();
+
+	std::cout << "Carving kernel: " << CarvingKernel::getName(m_carving_isa) << std::endl;
 }
 
-Reconstructor::~Reconstructor() = default;
+Reconstructor::~Reconstructor()
+{
+	m_cancel_build = true;
+	if (m_lut_builder.joinable())
+		m_lut_builder.join();
+}
 
 /**
  * Create some Look Up Tables
  * 	- LUT for the scene's box corners
- * 	- LUT with a map of the entire voxelspace: point-on-cam to voxels
- * 	- LUT with a map of the entire voxelspace: voxel to cam points-on-cam
+ * 	- LUT with the candidate voxels, those within the FoV of every camera:
+ * 	  their volume index and their points-on-cam, stored per camera as
+ * 	  linear pixel offsets
  */
 void Reconstructor::initialize()
 {
-	// Cube dimensions from [(-m_height, m_height), (-m_height, m_height), (0, m_height)]
-	const int xL = -m_height;
-	const int xR = m_height;
-	const int yL = -m_height;
-	const int yR = m_height;
-	const int zL = 0;
-	const int zR = m_height;
-	const int plane_y = (yR - yL) / m_step;
-	const int plane_x = (xR - xL) / m_step;
-	const int plane = plane_y * plane_x;
+	// Volume dimensions from the configured bounds, trimmed to whole voxels
+	const int step = m_config.step;
+	const Vec3i dimension = m_config.getDimension();
+	const int xL = m_config.x_bounds[0];
+	const int xR = xL + dimension[0] * step;
+	const int yL = m_config.y_bounds[0];
+	const int yR = yL + dimension[1] * step;
+	const int zL = m_config.z_bounds[0];
+	const int zR = zL + dimension[2] * step;
 
 	// Save the 8 volume corners
 	// bottom
@@ -77,103 +145,825 @@ void Reconstructor::initialize()
 	m_corners.emplace_back((float) xR, (float) yR, (float) zR);
 	m_corners.emplace_back((float) xR, (float) yL, (float) zR);
 
-	// Acquire some memory for efficiency
-	std::cout << "Initializing " << m_voxels_amount << " voxels..." << std::endl;
-	m_voxels.resize(m_voxels_amount);
+	m_grid.origin = Point3i(xL, yL, zL);
+	m_grid.dimension = dimension;
+	m_grid.step = step;
+
+	// Reuse the LUT of a previous run when the calibration and volume didn't change
+	m_lut_key = getLUTKey(xL, xR, yL, yR, zL, zR);
+	m_lut_cache_file = m_cameras.empty() ? std::filesystem::path()
+			: m_cameras.front().getDataPath().parent_path() / LUT_CACHE_FILE;
+
+	if (m_config.engine == CarvingEngine::OnTheFly)
+	{
+		// Only keep the candidates, their pixels are computed every frame
+		std::cout << "Finding candidates among " << m_voxels_amount << " voxels..." << std::endl;
+		m_on_the_fly.build(m_grid, m_cameras);
+
+		std::vector<uint32_t> candidates;
+		m_on_the_fly.findCandidates(candidates);
+		const std::vector<uint32_t> entries = getCandidateEntries(candidates);
+		m_lut = ProjectionLUT(candidates.size(), 0);
+		for (size_t k = 0; k < candidates.size(); ++k)
+			m_lut.setVoxelIndex(entries[k], candidates[k]);
+		m_lut.finalize();
+	}
+	else if (!m_lut_cache_file.empty() && m_lut.load(m_lut_cache_file, m_lut_key, m_cameras.size()))
+	{
+		std::cout << "Mapped the LUT from " << m_lut_cache_file << std::endl;
+	}
+	else
+	{
+		// Slabs of whole Morton slabs, so concatenating them keeps the candidate order
+		m_slab_luts.resize((dimension[2] + VoxelOrder::SLAB_DEPTH - 1) / VoxelOrder::SLAB_DEPTH);
+		if (m_config.lazy_lut)
+		{
+			std::cout << "Initializing " << m_voxels_amount << " voxels in the background..." << std::endl;
+			m_lut_builder = std::thread(&Reconstructor::buildLUT, this, false);
+			return;
+		}
+
+		std::cout << "Initializing " << m_voxels_amount << " voxels..." << std::endl;
+		buildLUT(true);
+		m_lut = std::move(m_built_lut);
+		m_slab_luts.clear();
+	}
+
+	activateLUT();
+}
+
+/**
+ * Build the LUT z-slab by z-slab into m_slab_luts, publishing every finished
+ * slab through m_ready_slabs, then join the slabs into m_built_lut and save
+ * it to the cache file. Runs on the background thread for a lazy LUT, which
+ * only reads the cameras' calibration.
+ */
+void Reconstructor::buildLUT(
+		bool report)
+{
+	const size_t slabs = m_slab_luts.size();
+	std::vector<size_t> slab_first(slabs + 1, 0);
+	for (size_t s = 0; s < slabs; ++s)
+	{
+		if (m_cancel_build)
+			return;
+
+		m_slab_luts[s] = buildSlab((int) s);
+		slab_first[s + 1] = slab_first[s] + m_slab_luts[s].getVoxelCount();
+		m_ready_slabs.store(s + 1, std::memory_order_release);
+
+		if (report)
+			std::cout << (s + 1) * 100 / slabs << "%\r" << std::flush;
+	}
+
+	m_built_lut = ProjectionLUT(slab_first.back(), m_cameras.size());
+	int64_t s;
+#pragma omp parallel for schedule(dynamic) private(s)
+	for (s = 0; s < (int64_t) slabs; ++s)
+		m_built_lut.setEntries(slab_first[s], m_slab_luts[s]);
+	m_built_lut.finalize();
+
+	if (!m_lut_cache_file.empty() && !m_built_lut.save(m_lut_cache_file, m_lut_key))
+		std::cerr << "Unable to write LUT cache: " << m_lut_cache_file << std::endl;
+
+	m_lut_built.store(true, std::memory_order_release);
+}
+
+/**
+ * The part of the LUT for z-slab 'slab': the voxels of its layers that
+ * project inside every camera's image, in the configured candidate order
+ */
+ProjectionLUT Reconstructor::buildSlab(
+		int slab) const
+{
+	const Vec3i& dimension = m_grid.dimension;
+	const int z_first = slab * VoxelOrder::SLAB_DEPTH;
+	const int z_last = std::min(z_first + VoxelOrder::SLAB_DEPTH, dimension[2]);
+	const int rows = (z_last - z_first) * dimension[1];
+	const uint32_t first_voxel = (uint32_t) z_first * dimension[1] * dimension[0];
+
+	// Per voxel row: the voxels visible on all cameras and their pixels, camera-major
+	std::vector<std::vector<uint32_t>> row_voxels(rows);
+	std::vector<std::vector<Point>> row_pixels(rows);
+
+	int r;
+#pragma omp parallel for schedule(dynamic) private(r)
+	for (r = 0; r < rows; ++r)
+	{
+		// Project the whole row per camera in one batch
+		const uint32_t first = first_voxel + (uint32_t) r * dimension[0];
+		std::vector<Point3f> points;
+		points.reserve(dimension[0]);
+		for (int x = 0; x < dimension[0]; ++x)
+		{
+			const Point3i coordinate = m_grid.coordinate(first + x);
+			points.emplace_back((float) coordinate.x, (float) coordinate.y, (float) coordinate.z);
+		}
+
+		std::vector<Point> pixels(points.size() * m_cameras.size());
+		std::vector<uint8_t> visible(points.size(), 1);
+		const Rect image(Point(0, 0), m_plane_size);
+		for (size_t c = 0; c < m_cameras.size(); ++c)
+		{
+			Point* camera_pixels = pixels.data() + c * points.size();
+			if (m_config.projection == ProjectionModel::Pinhole)
+				m_cameras[c].projectOnUndistortedView(points.data(), points.size(), camera_pixels);
+			else
+				m_cameras[c].projectOnView(points.data(), points.size(), camera_pixels);
+			for (size_t i = 0; i < points.size(); ++i)
+				visible[i] &= image.contains(camera_pixels[i]);
+		}
+
+		// A voxel outside any camera's FoV can never be carved as occupied, only keep the candidates
+		std::vector<uint32_t>& voxels = row_voxels[r];
+		for (size_t i = 0; i < points.size(); ++i)
+			if (visible[i])
+				voxels.push_back(first + (uint32_t) i);
+
+		std::vector<Point>& candidate_pixels = row_pixels[r];
+		candidate_pixels.reserve(voxels.size() * m_cameras.size());
+		for (size_t c = 0; c < m_cameras.size(); ++c)
+			for (const uint32_t v : voxels)
+				candidate_pixels.push_back(pixels[c * points.size() + (v - first)]);
+	}
+
+	// Number the candidates in ascending voxel order, then place them in the configured order
+	std::vector<size_t> row_first(rows + 1, 0);
+	for (int i = 0; i < rows; ++i)
+		row_first[i + 1] = row_first[i] + row_voxels[i].size();
+	std::vector<uint32_t> candidates;
+	candidates.reserve(row_first.back());
+	for (const auto& voxels : row_voxels)
+		candidates.insert(candidates.end(), voxels.begin(), voxels.end());
+	const std::vector<uint32_t> entries = getCandidateEntries(candidates);
+	std::vector<uint32_t>().swap(candidates);
+
+	ProjectionLUT lut(row_first.back(), m_cameras.size());
+#pragma omp parallel for schedule(static) private(r)
+	for (r = 0; r < rows; ++r)
+	{
+		const std::vector<uint32_t>& voxels = row_voxels[r];
+		for (size_t k = 0; k < voxels.size(); ++k)
+		{
+			const size_t e = entries[row_first[r] + k];
+			lut.setVoxelIndex(e, voxels[k]);
+			for (size_t c = 0; c < m_cameras.size(); ++c)
+				lut.setProjection(c, e, row_pixels[r][c * voxels.size() + k], m_plane_size);
+		}
+	}
+
+	lut.finalize();
+	return lut;
+}
+
+/**
+ * Start carving with the finished LUT: size the occupancy and build what
+ * the carving mode needs
+ */
+void Reconstructor::activateLUT()
+{
+	m_occupancy.assign(m_lut.getWordCount(), 0);
+	m_lut_active = true;
+
+	std::cout << "Candidates: " << m_lut.getVoxelCount() << " of " << m_voxels_amount << " voxels are visible on all cameras"
+			<< std::endl;
+	std::cout << "LUT size: " << m_lut.getMemoryUsage() / (1024.0 * 1024.0) << " MB" << std::endl;
+	std::cout << "done!" << std::endl;
+
+	prepareCarvingMode();
+}
+
+/**
+ * Switch to the LUT built in the background once it is finished. The voxels
+ * of the preview are cleared, the first full update carves them again.
+ * Returns whether the full LUT is in use.
+ */
+bool Reconstructor::activateBuiltLUT()
+{
+	if (!m_lut_built.load(std::memory_order_acquire))
+		return false;
+	m_lut_builder.join();
 
-	int z;
-	int pdone = 0;
-#pragma omp parallel for schedule(runtime) private(z) shared(pdone)
-	for (z = zL; z < zR; z += m_step)
+	for (size_t s = 0; s < m_slab_occupancy.size(); ++s)
 	{
-		const int zp = (z - zL) / m_step;
-		int done = cvRound((zp * plane / (double) m_voxels_amount) * 100.0);
+		const uint32_t* voxels = m_slab_luts[s].getVoxelIndices();
+		for (size_t w = 0; w < m_slab_occupancy[s].size(); ++w)
+			applyOccupancyWord(voxels + w * 64, m_slab_occupancy[s][w], 0);
+	}
+	m_slab_occupancy.clear();
+	m_slab_luts.clear();
+
+	m_lut = std::move(m_built_lut);
+	activateLUT();
+	return true;
+}
+
+/**
+ * LUT entry of every candidate (ascending volume indices) in the configured
+ * candidate order
+ */
+std::vector<uint32_t> Reconstructor::getCandidateEntries(
+		const std::vector<uint32_t> &candidates) const
+{
+	std::vector<uint32_t> entries;
+	if (m_config.order == CandidateOrder::Morton)
+	{
+		VoxelOrder::getMortonRanks(m_grid, candidates, entries);
+	}
+	else
+	{
+		entries.resize(candidates.size());
+		std::iota(entries.begin(), entries.end(), 0u);
+	}
+	return entries;
+}
+
+/**
+ * Hash of everything the projection LUT depends on: the volume bounds and
+ * step, the candidate order, and every camera's image size, intrinsics and
+ * extrinsics
+ */
+uint64_t Reconstructor::getLUTKey(
+		int xL, int xR, int yL, int yR, int zL, int zR) const
+{
+	const int volume[] = { xL, xR, yL, yR, zL, zR, m_config.step, (int) m_cameras.size(), (int) m_config.order,
+			(int) m_config.projection };
+	uint64_t hash = fnv1a(volume, sizeof(volume));
+
+	for (const auto& camera : m_cameras)
+	{
+		const int size[] = { camera.getSize().width, camera.getSize().height };
+		hash = fnv1a(size, sizeof(size), hash);
+		hash = fnv1a(camera.getCameraMatrix(), hash);
+		hash = fnv1a(camera.getDistortionCoeffs(), hash);
+		hash = fnv1a(camera.getRotationValues(), hash);
+		hash = fnv1a(camera.getTranslationValues(), hash);
+	}
+
+	return hash;
+}
+
+/**
+ * Count the amount of camera's each candidate voxel appears on, if that
+ * amount equals the amount of cameras, set the candidate's occupancy bit
+ * and add its voxel to the visible voxels
+ */
+void Reconstructor::update()
+{
+	m_carving_stats.voxels = 0;
+	m_carving_stats.lookups = 0;
+	m_carving_stats.order = m_camera_order;
+	m_carving_stats.tested.assign(m_cameras.size(), 0);
+	m_carving_stats.rejected.assign(m_cameras.size(), 0);
+
+	if (!m_lut_active && !activateBuiltLUT())
+	{
+		updatePreview();
+		m_scalar_field.releaseEmptyBricks();
+		return;
+	}
+
+	if (m_config.engine == CarvingEngine::OnTheFly)
+	{
+		updateOnTheFly();
+	}
+	else
+	{
+		std::vector<const uint32_t*> offsets;
+		std::vector<const uint64_t*> valid;
+		std::vector<const uint8_t*> foregrounds;
+		const CarvingInput input = getCarvingInput(offsets, valid, foregrounds);
+
+		switch (m_mode)
+		{
+		case CarvingMode::Hierarchical:
+			updateHierarchical(input);
+			break;
+		case CarvingMode::Footprint:
+			updateFootprint();
+			break;
+		case CarvingMode::PixelDriven:
+			updatePixelDriven(input);
+			break;
+		case CarvingMode::Incremental:
+			if (updateIncremental(input))
+				break;
+			[[fallthrough]];
+		default:
+			updateFull(input);
+			break;
+		}
+	}
+
+	for (size_t c = 0; c < m_cameras.size(); ++c)
+		m_carved_generations[c] = m_cameras[c].getForegroundGeneration();
+	m_occupancy_valid = true;
+
+	compactVisibleVoxels();
+	m_scalar_field.releaseEmptyBricks();
+}
+
+/**
+ * Select how update() carves the volume, building the look up tables the
+ * mode needs on first use
+ */
+void Reconstructor::setCarvingMode(
+		CarvingMode mode)
+{
+	if (m_config.engine == CarvingEngine::OnTheFly && mode != CarvingMode::Dense)
+	{
+		std::cerr << "The on the fly engine only carves densely, ignoring the carving mode" << std::endl;
+		mode = CarvingMode::Dense;
+	}
+	if (m_config.projection == ProjectionModel::Pinhole && mode != CarvingMode::Dense && mode != CarvingMode::PixelDriven)
+	{
+		// Changed pixels and integral images are only kept for the distorted images
+		std::cerr << "The pinhole projection only carves densely or pixel driven, ignoring the carving mode" << std::endl;
+		mode = CarvingMode::Dense;
+	}
+
+	m_mode = mode;
+	prepareCarvingMode();
+}
+
+/**
+ * Build the look up tables the carving mode needs, once the LUT is ready
+ */
+void Reconstructor::prepareCarvingMode()
+{
+	if (!m_lut_active)
+		return;
+
+	if ((m_mode == CarvingMode::Incremental || m_mode == CarvingMode::PixelDriven) && m_pixel_index.empty())
+	{
+		m_pixel_index.build(m_lut, (size_t) m_plane_size.area());
+		std::cout << "Pixel to voxel index size: " << m_pixel_index.getMemoryUsage() / (1024.0 * 1024.0) << " MB" << std::endl;
+	}
+	if (m_mode == CarvingMode::Hierarchical && m_hierarchy.empty())
+	{
+		m_hierarchy.build(m_grid, m_lut, m_plane_size, HIERARCHY_LEAF_SIZE, HIERARCHY_LEVELS);
+		std::cout << "Cell footprints size: " << m_hierarchy.getMemoryUsage() / (1024.0 * 1024.0) << " MB" << std::endl;
+	}
+	if (m_mode == CarvingMode::Footprint && m_footprints.empty())
+	{
+		m_footprints.build(m_grid, m_lut, m_cameras);
+		std::cout << "Voxel footprints size: " << m_footprints.getMemoryUsage() / (1024.0 * 1024.0) << " MB" << std::endl;
+	}
+}
+
+/**
+ * Test the cameras in their order of selectivity (true) or in index order
+ */
+void Reconstructor::setAdaptiveCameraOrder(
+		bool adaptive)
+{
+	m_adaptive_order = adaptive;
+	if (!m_adaptive_order)
+		std::iota(m_camera_order.begin(), m_camera_order.end(), 0);
+}
+
+/**
+ * The foreground image of camera 'c' the LUT's pixel offsets refer to: the
+ * undistorted one under the pinhole projection model
+ */
+const Mat& Reconstructor::getCarvingForeground(
+		size_t c) const
+{
+	return m_config.projection == ProjectionModel::Pinhole ? m_cameras[c].getUndistortedForeground()
+			: m_cameras[c].getForegroundImage();
+}
+
+/**
+ * Point the carving kernel at this frame's foreground images, in the order
+ * the cameras are to be tested
+ */
+CarvingInput Reconstructor::getCarvingInput(
+		std::vector<const uint32_t*> &offsets, std::vector<const uint64_t*> &valid, std::vector<const uint8_t*> &foregrounds) const
+{
+	offsets.resize(m_cameras.size());
+	valid.resize(m_cameras.size());
+	foregrounds.resize(m_cameras.size());
+	for (size_t k = 0; k < m_cameras.size(); ++k)
+	{
+		const size_t c = m_camera_order[k];
+		const Mat& foreground = getCarvingForeground(c);
+		assert(foreground.isContinuous());
+		assert(foreground.size() == m_plane_size);
+		offsets[k] = m_lut.getOffsets(c);
+		valid[k] = m_lut.getValidMask(c);
+		foregrounds[k] = foreground.ptr<uint8_t>();
+	}
+	return CarvingInput { offsets.data(), valid.data(), foregrounds.data(), m_cameras.size() };
+}
+
+/**
+ * Replace the occupancy word 'current' of the 64 candidates 'voxels' by
+ * 'word', only touching the scalar field of candidates that flipped
+ */
+inline void Reconstructor::applyOccupancyWord(
+		const uint32_t* voxels, uint64_t &current, uint64_t word)
+{
+	BitOps::forEachBit(word ^ current, [&](int bit)
+	{
+		m_scalar_field.at(voxels[bit]).a = (word >> bit) & 1u ? 1.0f : 0.0f;
+	});
+	current = word;
+}
+
+/**
+ * Store a freshly carved occupancy word
+ */
+inline void Reconstructor::setOccupancyWord(
+		size_t w, uint64_t word)
+{
+	applyOccupancyWord(m_lut.getVoxelIndices() + w * 64, m_occupancy[w], word);
+}
+
+/**
+ * Carve one occupancy word: a candidate is occupied if it is present on all cameras
+ */
+inline void Reconstructor::carveWord(
+		const CarvingInput &input, size_t w, CarvingCounters &counters)
+{
+	setOccupancyWord(w, m_carve(input, w, counters));
+}
+
+/**
+ * Carve the occupancy words words[0, count), or [0, count) if words is null,
+ * and gather the early exit counters of all threads
+ */
+void Reconstructor::carveWords(
+		const CarvingInput &input, const uint32_t* words, size_t count)
+{
+	uint64_t entered = 0;
+	std::vector<uint64_t> rejected(input.camera_count, 0);
+
+	// Work on whole 64 voxel words so no two threads write the same occupancy word
+#pragma omp parallel
+	{
+		std::vector<uint64_t> thread_rejected(input.camera_count, 0);
+		CarvingCounters counters { 0, thread_rejected.data() };
+
+		int64_t i;
+#pragma omp for schedule(runtime)
+		for (i = 0; i < (int64_t) count; ++i)
+			carveWord(input, words ? words[i] : (size_t) i, counters);
 
 #pragma omp critical
-		if (done > pdone)
 		{
-			pdone = done;
-			std::cout << done << "%\r" << std::flush;
+			entered += counters.entered;
+			for (size_t k = 0; k < input.camera_count; ++k)
+				rejected[k] += thread_rejected[k];
 		}
+	}
+
+	updateCameraOrder(entered, rejected);
+}
+
+/**
+ * Add the early exit counters (by test position) to this update's statistics
+ * and move the cameras that reject most of the voxels they see to the front
+ */
+void Reconstructor::updateCameraOrder(
+		uint64_t entered, const std::vector<uint64_t> &rejected)
+{
+	uint64_t tested = entered;
+	for (size_t k = 0; k < rejected.size(); ++k)
+	{
+		const size_t c = m_camera_order[k];
+		m_carving_stats.tested[c] += tested;
+		m_carving_stats.rejected[c] += rejected[k];
+		m_carving_stats.lookups += tested;
+		if (tested > 0)
+			m_rejection_rates[c] = CAMERA_ORDER_SMOOTHING * m_rejection_rates[c]
+					+ (1.0 - CAMERA_ORDER_SMOOTHING) * rejected[k] / (double) tested;
+		tested -= rejected[k];
+	}
+	m_carving_stats.voxels += entered;
 
-		int y, x;
-		for (y = yL; y < yR; y += m_step)
+	if (m_adaptive_order)
+		std::stable_sort(m_camera_order.begin(), m_camera_order.end(), [this](size_t a, size_t b)
 		{
-			const int yp = (y - yL) / m_step;
+			return m_rejection_rates[a] > m_rejection_rates[b];
+		});
+}
 
-			for (x = xL; x < xR; x += m_step)
-			{
-				const int xp = (x - xL) / m_step;
+/**
+ * Carve every candidate voxel
+ */
+void Reconstructor::updateFull(
+		const CarvingInput &input)
+{
+	carveWords(input, nullptr, m_occupancy.size());
+	m_tested_voxels = m_lut.getVoxelCount();
+}
+
+/**
+ * Carve every candidate voxel, projecting it onto the undistorted foreground
+ * images on the fly instead of looking its pixels up
+ */
+void Reconstructor::updateOnTheFly()
+{
+	std::vector<const uint8_t*> masks(m_cameras.size());
+	for (size_t c = 0; c < m_cameras.size(); ++c)
+	{
+		const Mat& mask = m_cameras[c].getUndistortedForeground();
+		assert(mask.isContinuous() && mask.size() == m_plane_size);
+		masks[c] = mask.ptr<uint8_t>();
+	}
 
-				const int p = zp * plane + yp * plane_x + xp;  // The voxel's index
+	const uint32_t* candidates = m_lut.getVoxelIndices();
+	const size_t count = m_lut.getVoxelCount();
 
-				// Create all voxels
-				Voxel* voxel = &m_voxels[p];
-				voxel->coordinate.x = x;
-				voxel->coordinate.y = y;
-				voxel->coordinate.z = z;
-				voxel->camera_projection = std::vector<Point>(m_cameras.size());
-				voxel->valid_camera_projection = std::vector<int>(m_cameras.size(), 0);
+	int64_t w;
+#pragma omp parallel for schedule(runtime) private(w)
+	for (w = 0; w < (int64_t) m_occupancy.size(); ++w)
+	{
+		const size_t first = (size_t) w * 64;
+		setOccupancyWord((size_t) w, m_on_the_fly.carveWord(candidates + first, std::min<size_t>(64, count - first), masks));
+	}
 
-				for (size_t c = 0; c < m_cameras.size(); ++c)
-				{
-					Point point = m_cameras[c].projectOnView(Point3f((float)x, (float)y, (float)z));
+	m_tested_voxels = count;
+}
+
+/**
+ * Only re-carve the occupancy words holding a candidate that projects onto a
+ * foreground pixel that flipped since the last update. All other candidates see
+ * exactly the same pixels as before, so the result is identical to a full
+ * update. Returns false if the changes can't be used and a full update is
+ * needed instead.
+ */
+bool Reconstructor::updateIncremental(
+		const CarvingInput &input)
+{
+	if (!m_occupancy_valid || m_pixel_index.empty())
+		return false;
 
-					// Save the pixel coordinates 'point' of the voxel projection on camera 'c'
-					voxel->camera_projection[(int) c] = point;
+	size_t changed = 0;
+	for (size_t c = 0; c < m_cameras.size(); ++c)
+	{
+		// The change list only covers the step from the previous foreground image
+		const Camera& camera = m_cameras[c];
+		if (!camera.hasForegroundChanges() || camera.getForegroundGeneration() != m_carved_generations[c] + 1)
+			return false;
+		changed += camera.getChangedPixels().size();
+	}
+	if (changed > INCREMENTAL_MAX_CHANGE * m_plane_size.area() * m_cameras.size())
+		return false;
 
-					// If it's within the camera's FoV, flag the projection
-					if (point.x >= 0 && point.x < m_plane_size.width && point.y >= 0 && point.y < m_plane_size.height)
-						voxel->valid_camera_projection[(int) c] = 1;
-				}
+	m_dirty_words.assign((m_occupancy.size() + 63) / 64, 0);
+	for (size_t c = 0; c < m_cameras.size(); ++c)
+	{
+		for (const uint32_t pixel : m_cameras[c].getChangedPixels())
+		{
+			for (const uint32_t* v = m_pixel_index.begin(c, pixel); v != m_pixel_index.end(c, pixel); ++v)
+			{
+				const uint32_t w = *v >> 6;
+				m_dirty_words[w >> 6] |= uint64_t(1) << (w & 63);
 			}
 		}
 	}
 
-	std::cout << "done!" << std::endl;
+	m_dirty_word_list.clear();
+	for (size_t d = 0; d < m_dirty_words.size(); ++d)
+	{
+		BitOps::forEachBit(m_dirty_words[d], [&](int bit)
+		{
+			m_dirty_word_list.push_back((uint32_t) (d * 64 + bit));
+		});
+	}
+
+	carveWords(input, m_dirty_word_list.data(), m_dirty_word_list.size());
+	m_tested_voxels = m_dirty_word_list.size() * 64;
+	return true;
 }
 
 /**
- * Count the amount of camera's each voxel in the space appears on,
- * if that amount equals the amount of cameras, add that voxel to the
- * visible_voxels vector
+ * Carve coarse cells against the foreground integral images and only refine
+ * the partially occupied ones, then apply the changes to the scalar field
  */
-void Reconstructor::update()
+void Reconstructor::updateHierarchical(
+		const CarvingInput &input)
+{
+	std::vector<const cv::Mat*> integrals(m_cameras.size());
+	for (size_t c = 0; c < m_cameras.size(); ++c)
+		integrals[c] = &m_cameras[c].getForegroundIntegral();
+
+	// The cell footprints are stored per camera index, undo the test order
+	std::vector<const uint32_t*> offsets(input.camera_count);
+	std::vector<const uint8_t*> foregrounds(input.camera_count);
+	for (size_t k = 0; k < input.camera_count; ++k)
+	{
+		offsets[m_camera_order[k]] = input.offsets[k];
+		foregrounds[m_camera_order[k]] = input.foregrounds[k];
+	}
+
+	m_next_occupancy.assign(m_occupancy.size(), 0);
+	m_hierarchy.carve(integrals, offsets, foregrounds, m_next_occupancy);
+
+	int64_t w;
+#pragma omp parallel for schedule(static) private(w)
+	for (w = 0; w < (int64_t) m_occupancy.size(); ++w)
+		setOccupancyWord((size_t) w, m_next_occupancy[w]);
+
+	m_tested_voxels = m_hierarchy.getTestedVoxels();
+}
+
+/**
+ * Carve every candidate by the foreground fraction of its footprint on the
+ * foreground integral images
+ */
+void Reconstructor::updateFootprint()
+{
+	std::vector<const cv::Mat*> integrals(m_cameras.size());
+	for (size_t c = 0; c < m_cameras.size(); ++c)
+		integrals[c] = &m_cameras[c].getForegroundIntegral();
+
+	int64_t w;
+#pragma omp parallel for schedule(runtime) private(w)
+	for (w = 0; w < (int64_t) m_occupancy.size(); ++w)
+		setOccupancyWord((size_t) w, m_footprints.carveWord(integrals, m_lut, (size_t) w, m_config.fill_ratio));
+
+	m_tested_voxels = m_lut.getVoxelCount();
+}
+
+/**
+ * Carve the z-slabs of the LUT that are ready while the full LUT is still
+ * being built in the background, so a partial volume can be shown
+ */
+void Reconstructor::updatePreview()
 {
+	const size_t ready = m_ready_slabs.load(std::memory_order_acquire);
+	m_slab_occupancy.resize(ready);
 	m_visible_voxels_indices.clear();
-	std::vector<uint32_t> visible_voxels;
 
-	int32_t v;
-#pragma omp parallel for schedule(runtime) private(v) shared(visible_voxels)
-	for (v = 0; v < (uint32_t) m_voxels_amount; ++v)
+	for (size_t s = 0; s < ready; ++s)
 	{
-		int camera_counter = 0;
-		const Voxel* voxel = &m_voxels[v];
-		m_scalar_field[v].a = 0.0f;
+		const ProjectionLUT& lut = m_slab_luts[s];
+		std::vector<uint64_t>& occupancy = m_slab_occupancy[s];
+		occupancy.resize(lut.getWordCount(), 0);
+
+		std::vector<const uint32_t*> offsets(m_cameras.size());
+		std::vector<const uint64_t*> valid(m_cameras.size());
+		std::vector<const uint8_t*> foregrounds(m_cameras.size());
 		for (size_t c = 0; c < m_cameras.size(); ++c)
 		{
-			if (voxel->valid_camera_projection[c])
+			offsets[c] = lut.getOffsets(c);
+			valid[c] = lut.getValidMask(c);
+			foregrounds[c] = getCarvingForeground(c).ptr<uint8_t>();
+		}
+		const CarvingInput input { offsets.data(), valid.data(), foregrounds.data(), m_cameras.size() };
+
+#pragma omp parallel
+		{
+			std::vector<uint64_t> rejected(m_cameras.size(), 0);
+			CarvingCounters counters { 0, rejected.data() };
+
+			int64_t w;
+#pragma omp for schedule(runtime)
+			for (w = 0; w < (int64_t) occupancy.size(); ++w)
+				applyOccupancyWord(lut.getVoxelIndices() + w * 64, occupancy[w], m_carve(input, (size_t) w, counters));
+		}
+
+		for (size_t w = 0; w < occupancy.size(); ++w)
+		{
+			const uint32_t* voxels = lut.getVoxelIndices() + w * 64;
+			BitOps::forEachBit(occupancy[w], [&](int bit)
 			{
-				const Point point = voxel->camera_projection[c];
+				m_visible_voxels_indices.push_back(voxels[bit]);
+			});
+		}
+	}
+
+	m_tested_voxels = 0;
+}
+
+/**
+ * Carve starting from the image side: only the candidates projecting onto a
+ * foreground pixel of the camera with the least foreground can be occupied,
+ * so only those are looked up on the other cameras. The work scales with
+ * the silhouette area instead of the volume, only clearing and applying the
+ * occupancy words still touches every word.
+ */
+void Reconstructor::updatePixelDriven(
+		const CarvingInput &input)
+{
+	size_t seed = 0;
+	int seed_pixels = m_plane_size.area() + 1;
+	for (size_t k = 0; k < input.camera_count; ++k)
+	{
+		const int pixels = countNonZero(getCarvingForeground(m_camera_order[k]));
+		if (pixels < seed_pixels)
+		{
+			seed = k;
+			seed_pixels = pixels;
+		}
+	}
+
+	const size_t seed_camera = m_camera_order[seed];
+	const uint8_t* seed_foreground = input.foregrounds[seed];
+	m_next_occupancy.assign(m_occupancy.size(), 0);
+
+	size_t tested = 0;
+	int y;
+#pragma omp parallel for schedule(dynamic) private(y) reduction(+:tested)
+	for (y = 0; y < m_plane_size.height; ++y)
+	{
+		BitOps::BitWriter writer(m_next_occupancy.data());
+		for (uint32_t pixel = (uint32_t) y * m_plane_size.width; pixel < (uint32_t) (y + 1) * m_plane_size.width; ++pixel)
+		{
+			if (seed_foreground[pixel] != 255)
+				continue;
 
-				//If there's a white pixel on the foreground image at the projection point, add the camera
-				if (m_cameras[c].getForegroundImage().at<uchar>(point) == 255)
-				{
-					++camera_counter;
-				}
+			for (const uint32_t* e = m_pixel_index.begin(seed_camera, pixel); e != m_pixel_index.end(seed_camera, pixel); ++e)
+			{
+				size_t k = 0;
+				while (k < input.camera_count && (k == seed || (((input.valid[k][*e >> 6] >> (*e & 63)) & 1u)
+						&& input.foregrounds[k][input.offsets[k][*e]] == 255)))
+					++k;
+				if (k == input.camera_count)
+					writer.set(*e);
 			}
+			tested += m_pixel_index.end(seed_camera, pixel) - m_pixel_index.begin(seed_camera, pixel);
 		}
+	}
+
+	int64_t w;
+#pragma omp parallel for schedule(static) private(w)
+	for (w = 0; w < (int64_t) m_occupancy.size(); ++w)
+		setOccupancyWord((size_t) w, m_next_occupancy[w]);
+
+	m_tested_voxels = tested;
+}
+
+/**
+ * Rebuild the visible voxel indices from the occupancy bits without locks:
+ * count the voxels per block of words, prefix sum the counts into output
+ * offsets and let every block write its own slice. The indices come out
+ * in LUT entry order (ascending for the linear candidate order),
+ * independent of the thread count or schedule.
+ */
+void Reconstructor::compactVisibleVoxels()
+{
+	const size_t words = m_occupancy.size();
+	const size_t blocks = (words + COMPACTION_BLOCK_WORDS - 1) / COMPACTION_BLOCK_WORDS;
+	m_compaction_offsets.resize(blocks + 1);
+	m_compaction_offsets[0] = 0;
+
+	int64_t b;
+#pragma omp parallel for schedule(static) private(b)
+	for (b = 0; b < (int64_t) blocks; ++b)
+		m_compaction_offsets[b + 1] = countOccupied(b * COMPACTION_BLOCK_WORDS, (b + 1) * COMPACTION_BLOCK_WORDS);
+
+	std::partial_sum(m_compaction_offsets.begin(), m_compaction_offsets.end(), m_compaction_offsets.begin());
+	m_visible_voxels_indices.resize(m_compaction_offsets[blocks]);
 
-		// If the voxel is present on all cameras
-		if (camera_counter == m_cameras.size())
+#pragma omp parallel for schedule(static) private(b)
+	for (b = 0; b < (int64_t) blocks; ++b)
+	{
+		uint32_t* out = m_visible_voxels_indices.data() + m_compaction_offsets[b];
+		const size_t last = std::min((b + 1) * COMPACTION_BLOCK_WORDS, words);
+		for (size_t w = b * COMPACTION_BLOCK_WORDS; w < last; ++w)
 		{
-			m_scalar_field[v].a = 1.0f;
-#pragma omp critical //push_back is critical
-			visible_voxels.push_back(v);
+			const uint32_t* voxels = m_lut.getVoxelIndices() + w * 64;
+			BitOps::forEachBit(m_occupancy[w], [&](int bit)
+			{
+				*out++ = voxels[bit];
+			});
 		}
 	}
+}
+
+/**
+ * Amount of occupied candidates in the occupancy words [first_word, last_word)
+ */
+size_t Reconstructor::countOccupied(size_t first_word, size_t last_word) const
+{
+	size_t count = 0;
+	for (size_t w = first_word; w < last_word && w < m_occupancy.size(); ++w)
+		count += BitOps::popcount(m_occupancy[w]);
+	return count;
+}
+
+/**
+ * Carve the fine sub-volumes around the clusters of the visible voxels,
+ * 'labels' holding the cluster of each visible voxel
+ */
+void Reconstructor::refine(
+		const std::vector<int>& labels, int cluster_count)
+{
+	if (!m_refiner.isEnabled())
+		return;
+
+	std::vector<const uint8_t*> masks(m_cameras.size());
+	for (size_t c = 0; c < m_cameras.size(); ++c)
+	{
+		const Mat& mask = m_cameras[c].getUndistortedForeground();
+		assert(mask.isContinuous() && mask.size() == m_plane_size);
+		masks[c] = mask.ptr<uint8_t>();
+	}
 
-	m_visible_voxels_indices.insert(m_visible_voxels_indices.end(), visible_voxels.begin(), visible_voxels.end());
+	m_refiner.refine(m_grid, m_visible_voxels_indices, labels, cluster_count, m_cameras, masks);
 }
 
 void Reconstructor::color(const std::vector<int>& labels, const std::vector<glm::vec4>& colors)
@@ -186,10 +976,12 @@ void Reconstructor::color(const std::vector<int>& labels, const std::vector<glm:
 		auto index = m_visible_voxels_indices[v];
 		const glm::vec4& color = colors[label];
 		assert(label < colors.size());
-		m_scalar_field[index].r = color[0];
-		m_scalar_field[index].g = color[1];
-		m_scalar_field[index].b = color[2];
+		glm::vec4& voxel = m_scalar_field.at(index);
+		voxel.r = color[0];
+		voxel.g = color[1];
+		voxel.b = color[2];
 	}
+	m_refiner.color(colors);
 }
 
 } /* namespace nl_uu_science_gmt */
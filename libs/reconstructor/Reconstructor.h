@@ -8,11 +8,25 @@
 #ifndef RECONSTRUCTOR_H_
 #define RECONSTRUCTOR_H_
 
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
+#include <cstdlib>
+#include <filesystem>
+#include <thread>
 #include <vector>
 #include <glm/vec4.hpp>
 
+#include "BrickVolume.h"
 #include "Camera.h"
+#include "CarvingKernel.h"
+#include "ClusterRefiner.h"
+#include "FootprintCarver.h"
+#include "HierarchicalCarver.h"
+#include "OnTheFlyCarver.h"
+#include "PixelVoxelIndex.h"
+#include "ProjectionLUT.h"
+#include "ReconstructionConfig.h"
 #include "Voxel.h"
 
 namespace nl_uu_science_gmt
@@ -20,10 +34,32 @@ namespace nl_uu_science_gmt
 
 class Reconstructor
 {
+public:
+	enum class CarvingMode
+	{
+		Dense,          // Test every voxel every frame
+		Incremental,    // Only re-test voxels projecting onto changed foreground pixels
+		Hierarchical,   // Test coarse cells first, only refine partially occupied ones
+		Footprint,      // Test the foreground fraction of each voxel's projected bounding box
+		PixelDriven     // Only test the voxels behind the foreground pixels of the most selective camera
+	};
+
+	/*
+	 * Early exit statistics of the carving kernels during the last update,
+	 * only gathered by dense and incremental carving
+	 */
+	struct CarvingStats
+	{
+		size_t voxels = 0;              // Tested voxels that are valid on all cameras
+		size_t lookups = 0;             // Foreground pixels looked up for them
+		std::vector<size_t> order;      // Cameras in the order they were tested
+		std::vector<size_t> tested;     // Per camera: voxels looked up on it
+		std::vector<size_t> rejected;   // Per camera: voxels it carved away
+	};
+
 private:
 	const std::vector<Camera> &m_cameras;  // vector of pointers to cameras
-	const int m_height;                     // Cube half-space height from floor to ceiling
-	const int m_step;                       // Step size (space between voxels)
+	ReconstructionConfig m_config;          // Volume bounds, step size (space between voxels) and budgets
 
 	std::vector<cv::Point3f> m_corners ;    // Cube half-space corner locations
 
@@ -31,17 +67,77 @@ private:
 	size_t m_voxels_amount;                 // Voxel count
 	cv::Size m_plane_size;                  // Camera FoV plane WxH
 
-	std::vector<Voxel> m_voxels;           // Pointer vector to all voxels in the half-space
+	VoxelGrid m_grid;                       // Index to coordinate mapping of all voxels in the half-space
+	ProjectionLUT m_lut;                    // Candidate voxels (visible on all cameras) and their pixel projections
+	uint64_t m_lut_key;                     // Hash of everything the LUT depends on
+	std::filesystem::path m_lut_cache_file; // Where the LUT is cached between runs
+	bool m_lut_active;                      // Whether m_lut is complete and carved with
+
+	// Background LUT build, see ReconstructionConfig::lazy_lut
+	std::thread m_lut_builder;
+	std::atomic<bool> m_lut_built;          // m_built_lut is complete
+	std::atomic<bool> m_cancel_build;       // Stop building, the reconstructor is destroyed
+	std::atomic<size_t> m_ready_slabs;      // Leading z-slabs of m_slab_luts that are complete
+	std::vector<ProjectionLUT> m_slab_luts; // Per z-slab its part of the LUT, while building
+	std::vector<std::vector<uint64_t>> m_slab_occupancy;   // Occupancy of the ready slabs shown meanwhile
+	ProjectionLUT m_built_lut;              // The LUT once all slabs are joined
+	CarvingKernel::Isa m_carving_isa;       // Instruction set of the carving kernel
+	CarvingKernel::Function m_carve;        // Carving kernel computing one occupancy word
+	std::vector<uint64_t> m_occupancy;      // Bit-packed occupancy, bit e set if candidate e is in the foreground of all cameras
+	bool m_occupancy_valid;                 // Whether m_occupancy matches the cameras' foreground generations below
+
+	CarvingMode m_mode;                     // How update() carves the volume
+	PixelVoxelIndex m_pixel_index;          // Pixel to candidates index for incremental and pixel driven carving
+	HierarchicalCarver m_hierarchy;         // Cell footprints for hierarchical carving
+	FootprintCarver m_footprints;           // Voxel footprints for footprint carving
+	OnTheFlyCarver m_on_the_fly;            // Projection matrices of the on the fly engine
+	ClusterRefiner m_refiner;               // Fine sub-volumes around the clusters
+	std::vector<uint64_t> m_next_occupancy; // Occupancy being carved hierarchically
+	std::vector<uint64_t> m_carved_generations;   // Foreground generation of each camera at the last update
+	std::vector<uint64_t> m_dirty_words;    // Bit w set if occupancy word w needs re-carving
+	std::vector<uint32_t> m_dirty_word_list;      // Indices of the set bits in m_dirty_words
+	size_t m_tested_voxels;                 // Candidates tested one by one in the last update
+	bool m_adaptive_order;                  // Whether the most selective cameras are tested first
+	std::vector<size_t> m_camera_order;     // Cameras in the order the carving kernel tests them
+	std::vector<double> m_rejection_rates;  // Smoothed fraction of its tested voxels each camera rejects
+	CarvingStats m_carving_stats;           // Early exit statistics of the last update
 	std::vector<uint32_t> m_visible_voxels_indices;   // Pointer vector to all visible voxels
-	std::vector<glm::vec4> m_scalar_field; // Values for each point in the half-space
+	std::vector<size_t> m_compaction_offsets;  // First visible voxel index of each compaction block
+	BrickVolume m_scalar_field;             // Color and occupancy (alpha) of the half-space, stored in sparse bricks
 
 	void initialize();
+	void buildLUT(bool);
+	ProjectionLUT buildSlab(int) const;
+	void activateLUT();
+	bool activateBuiltLUT();
+	void prepareCarvingMode();
+	const cv::Mat& getCarvingForeground(size_t) const;
+	std::vector<uint32_t> getCandidateEntries(const std::vector<uint32_t>&) const;
+	uint64_t getLUTKey(int, int, int, int, int, int) const;
+	CarvingInput getCarvingInput(std::vector<const uint32_t*>&, std::vector<const uint64_t*>&, std::vector<const uint8_t*>&) const;
+	void applyOccupancyWord(const uint32_t*, uint64_t&, uint64_t);
+	void setOccupancyWord(size_t, uint64_t);
+	void carveWord(const CarvingInput&, size_t, CarvingCounters&);
+	void carveWords(const CarvingInput&, const uint32_t*, size_t);
+	void updateCameraOrder(uint64_t, const std::vector<uint64_t>&);
+	void updateFull(const CarvingInput&);
+	bool updateIncremental(const CarvingInput&);
+	void updateHierarchical(const CarvingInput&);
+	void updateFootprint();
+	void updatePixelDriven(const CarvingInput&);
+	void updateOnTheFly();
+	void updatePreview();
+	void compactVisibleVoxels();
+	size_t countOccupied(size_t, size_t) const;
 
 public:
-	explicit Reconstructor(const std::vector<Camera>&);
+	explicit Reconstructor(const std::vector<Camera>&, const ReconstructionConfig& = ReconstructionConfig());
 	virtual ~Reconstructor();
 
 	void update();
+	void setCarvingMode(CarvingMode);
+	void setAdaptiveCameraOrder(bool);
+	void refine(const std::vector<int>& labels, int cluster_count);
 	void color(const std::vector<int>& labels, const std::vector<glm::vec4>& colors);
 
 	cv::Vec3w getVoxelDimension() const
@@ -51,7 +147,7 @@ public:
 
 	cv::Vec3i getOffset() const
 	{
-		return cv::Vec3i(-m_height, -m_height, 0);
+		return cv::Vec3i(m_config.x_bounds[0], m_config.y_bounds[0], m_config.z_bounds[0]);
 	}
 
 	uint32_t getVoxelCount() const
@@ -61,7 +157,7 @@ public:
 
 	uint32_t getVoxelSize() const
 	{
-		return m_step;
+		return m_config.step;
 	}
 
 	const std::vector<uint32_t>& getVisibleVoxelIndices() const
@@ -69,12 +165,71 @@ public:
 		return m_visible_voxels_indices;
 	}
 
-	const std::vector<Voxel>& getVoxels() const
+	// Whether the full LUT is in use, update() only carves a preview before
+	bool isLUTReady() const
+	{
+		return m_lut_active;
+	}
+
+	// Fraction of the LUT built so far
+	double getLUTProgress() const
+	{
+		return m_lut_active || m_slab_luts.empty() ? 1.0 : m_ready_slabs / (double) m_slab_luts.size();
+	}
+
+	size_t getCandidateCount() const
+	{
+		return m_lut.getVoxelCount();
+	}
+
+	// Volume index of every candidate, in LUT entry order
+	const uint32_t* getCandidateVoxelIndices() const
+	{
+		return m_lut.getVoxelIndices();
+	}
+
+	// Fine sub-volumes of the last refine(), in addition to the coarse volume, colored by color()
+	const std::vector<SubVolume>& getSubVolumes() const
+	{
+		return m_refiner.getSubVolumes();
+	}
+
+	const VoxelGrid& getVoxelGrid() const
 	{
-		return m_voxels;
+		return m_grid;
 	}
 
-	const std::vector<glm::vec4>& getScalarField() const
+	const ProjectionLUT& getProjectionLUT() const
+	{
+		return m_lut;
+	}
+
+	CarvingKernel::Isa getCarvingIsa() const
+	{
+		return m_carving_isa;
+	}
+
+	CarvingMode getCarvingMode() const
+	{
+		return m_mode;
+	}
+
+	size_t getTestedVoxelCount() const
+	{
+		return m_tested_voxels;
+	}
+
+	const CarvingStats& getCarvingStats() const
+	{
+		return m_carving_stats;
+	}
+
+	const BrickVolume& getScalarField() const
+	{
+		return m_scalar_field;
+	}
+
+	BrickVolume& getScalarField()
 	{
 		return m_scalar_field;
 	}
@@ -84,9 +239,16 @@ public:
 		return m_corners;
 	}
 
+	// Half extent of the floor area around the origin covered by the volume
 	int getSize() const
 	{
-		return m_height;
+		return std::max(std::max(std::abs(m_config.x_bounds[0]), std::abs(m_config.x_bounds[1])),
+				std::max(std::abs(m_config.y_bounds[0]), std::abs(m_config.y_bounds[1])));
+	}
+
+	const ReconstructionConfig& getConfig() const
+	{
+		return m_config;
 	}
 
 	const cv::Size& getPlaneSize() const
@@ -1,18 +1,46 @@
 #pragma once
 
-#include <vector>
+#include <cstddef>
+#include <cstdint>
 #include <opencv2/core/types.hpp>
 
 namespace nl_uu_science_gmt
 {
 /*
- * Voxel structure
- * Represents a 3D pixel in the half space
+ * Voxel grid structure
+ * Describes the regular grid of 3D pixels in the half space. Voxels are
+ * indexed linearly with x running fastest, then y, then z. A voxel's world
+ * coordinate is derived from its index instead of being stored.
  */
-struct Voxel
+struct VoxelGrid
 {
-  cv::Point3i coordinate;                     // Coordinates
-  std::vector <cv::Point> camera_projection;  // Projection location for camera[c]'s FoV (2D)
-  std::vector<int> valid_camera_projection;   // Flag if camera projection is in camera[c]'s FoV
+	cv::Point3i origin;     // World coordinate of voxel 0
+	cv::Vec3i dimension;    // Voxel count in each dimension
+	int step = 0;           // Step size (space between voxels)
+
+	size_t size() const
+	{
+		return (size_t) dimension[0] * dimension[1] * dimension[2];
+	}
+
+	uint32_t index(int xp, int yp, int zp) const
+	{
+		return (uint32_t) ((zp * dimension[1] + yp) * dimension[0] + xp);
+	}
+
+	// Grid position (xp, yp, zp) of voxel 'index'
+	cv::Vec3i position(uint32_t index) const
+	{
+		return cv::Vec3i(
+				(int) (index % (uint32_t) dimension[0]),
+				(int) ((index / (uint32_t) dimension[0]) % (uint32_t) dimension[1]),
+				(int) (index / ((uint32_t) dimension[0] * (uint32_t) dimension[1])));
+	}
+
+	cv::Point3i coordinate(uint32_t index) const
+	{
+		const cv::Vec3i p = position(index);
+		return cv::Point3i(origin.x + p[0] * step, origin.y + p[1] * step, origin.z + p[2] * step);
+	}
 };
 } /* namespace nl_uu_science_gmt */
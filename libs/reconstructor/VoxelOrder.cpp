@@ -0,0 +1,72 @@
+#include "VoxelOrder.h"
+
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+
+namespace nl_uu_science_gmt
+{
+
+namespace
+{
+
+/**
+ * Spread the lower 16 bits of 'v' to every third bit
+ */
+inline uint64_t spreadBits(
+		uint64_t v)
+{
+	v &= 0xffff;
+	v = (v | (v << 32)) & 0x0000ffff0000ffffull;
+	v = (v | (v << 16)) & 0x00ff0000ff0000ffull;
+	v = (v | (v << 8)) & 0xf00f00f00f00f00full;
+	v = (v | (v << 4)) & 0x30c30c30c30c30c3ull;
+	v = (v | (v << 2)) & 0x9249249249249249ull;
+	return v;
+}
+
+}
+
+namespace VoxelOrder
+{
+
+/**
+ * Sort key of the grid position (xp, yp, zp): its slab first, then its
+ * position on the Z-order curve within the slab
+ */
+uint64_t getMortonKey(
+		const cv::Vec3i &position)
+{
+	assert(position[0] < 65536 && position[1] < 65536);
+	const uint64_t slab = (uint64_t) (position[2] / SLAB_DEPTH);
+	const uint64_t z = (uint64_t) (position[2] % SLAB_DEPTH);
+	return slab << 48 | spreadBits(z) << 2 | spreadBits(position[1]) << 1 | spreadBits(position[0]);
+}
+
+/**
+ * For every candidate (volume indices, ascending) its position in Morton order
+ */
+void getMortonRanks(
+		const VoxelGrid &grid, const std::vector<uint32_t> &candidates, std::vector<uint32_t> &ranks)
+{
+	std::vector<uint64_t> keys(candidates.size());
+	int64_t i;
+#pragma omp parallel for schedule(static) private(i)
+	for (i = 0; i < (int64_t) candidates.size(); ++i)
+		keys[i] = getMortonKey(grid.position(candidates[i]));
+
+	std::vector<uint32_t> order(candidates.size());
+	std::iota(order.begin(), order.end(), 0u);
+	std::sort(order.begin(), order.end(), [&keys](uint32_t a, uint32_t b)
+	{
+		return keys[a] < keys[b];
+	});
+
+	ranks.resize(candidates.size());
+	for (size_t r = 0; r < order.size(); ++r)
+		ranks[order[r]] = (uint32_t) r;
+}
+
+}
+
+} /* namespace nl_uu_science_gmt */
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Voxel.h"
+
+namespace nl_uu_science_gmt
+{
+/*
+ * Storage order of the candidate voxels
+ * In linear order consecutive candidates run along x, so every row jumps
+ * across the camera images. In Morton order the candidates of each slab of
+ * SLAB_DEPTH z-layers follow a Z-order curve over (x, y, z), which keeps
+ * candidates that are close in space, and thus in every image, close in
+ * memory. Slabs stay in ascending z, so a slab's candidates are contiguous.
+ */
+namespace VoxelOrder
+{
+constexpr int SLAB_DEPTH = 8;
+
+uint64_t getMortonKey(const cv::Vec3i &position);
+void getMortonRanks(const VoxelGrid &grid, const std::vector<uint32_t> &candidates, std::vector<uint32_t> &ranks);
+}
+} /* namespace nl_uu_science_gmt */
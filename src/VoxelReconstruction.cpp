@@ -29,24 +29,23 @@ namespace nl_uu_science_gmt
 /**
  * Main constructor, initialized all cameras
  */
-VoxelReconstruction::VoxelReconstruction(std::filesystem::path dp, int cam_views_amount) :
-		m_data_path(std::move(dp))
+VoxelReconstruction::VoxelReconstruction(std::filesystem::path dp, const ReconstructionConfig &config) :
+		m_data_path(std::move(dp)),
+		m_config(config)
 {
-	for (int v = 0; v < cam_views_amount; ++v)
+	for (int v = 0; v < m_config.camera_count; ++v)
 	{
 		auto full_path = m_data_path / ("cam" + std::to_string(v + 1));
 
 		/*
-		 * Assert that there's a background image or video file and \
-		 * that there's a video file
+		 * Assert that there's a video file, the background is learned from it
+		 * (seeded with the background image if configured)
 		 */
-		std::cout << full_path / General::BackgroundImageFile << std::endl;
+		if (m_config.seed_background)
+			std::cout << full_path / General::BackgroundImageFile << std::endl;
 		std::cout << full_path / General::VideoFile << std::endl;
-		assert(
-			std::filesystem::exists(full_path / General::BackgroundImageFile)
-			&&
-			std::filesystem::exists(full_path /General::VideoFile)
-		);
+		assert(std::filesystem::exists(full_path / General::VideoFile));
+		assert(!m_config.seed_background || std::filesystem::exists(full_path / General::BackgroundImageFile));
 
 		/*
 		 * Assert that if there's no config.xml file, there's an intrinsics file and
@@ -79,6 +78,8 @@ void VoxelReconstruction::showKeys()
 	std::cout << "i       : Show/hide camera numbers (Linux only)" << std::endl;
 	std::cout << "o       : Show/hide origin" << std::endl;
 	std::cout << "t       : Top view" << std::endl;
+	std::cout << "e       : Calibrate the HSV thresholds" << std::endl;
+	std::cout << "a       : Keep tuning the HSV thresholds during playback" << std::endl;
 	std::cout << "1,2,3,4 : Switch camera #" << std::endl << std::endl;
 	std::cout << "Zoom with the scrollwheel while on the 3D scene" << std::endl;
 	std::cout << "Rotate the 3D scene with left click+drag" << std::endl << std::endl;
@@ -94,14 +95,15 @@ void VoxelReconstruction::run(int argc, char** argv)
 {
 	for (auto& v : m_cam_views)
 	{
-		auto ok = v.initialize(General::BackgroundImageFile, General::VideoFile);
+		auto ok = v.initialize(m_config.seed_background ? General::BackgroundImageFile : "", General::VideoFile);
 		assert(ok);
 	}
 
 	destroyAllWindows();
 	namedWindow(VIDEO_WINDOW.data(), CV_WINDOW_KEEPRATIO);
 
-	Reconstructor reconstructor(m_cam_views);
+	Reconstructor reconstructor(m_cam_views, m_config);
+	reconstructor.setCarvingMode(Reconstructor::CarvingMode::Incremental);
 	Scene3DRenderer scene3d(reconstructor, m_cam_views);
 	Renderer glut(scene3d);
 
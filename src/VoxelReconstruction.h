@@ -12,6 +12,7 @@
 #include <vector>
 
 #include <Camera.h>
+#include <ReconstructionConfig.h>
 
 namespace nl_uu_science_gmt
 {
@@ -19,10 +20,11 @@ namespace nl_uu_science_gmt
 class VoxelReconstruction
 {
 	const std::filesystem::path m_data_path;
+	const ReconstructionConfig m_config;
 	std::vector<Camera> m_cam_views;
 
 public:
-	VoxelReconstruction(std::filesystem::path , int);
+	VoxelReconstruction(std::filesystem::path , const ReconstructionConfig &);
 	virtual ~VoxelReconstruction();
 
 	static void showKeys();
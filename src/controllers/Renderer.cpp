@@ -45,6 +45,29 @@ struct DrawArraysIndirectCommand {
   uint32_t baseInstance;
 };
 
+struct vertex_t
+{
+	glm::vec4 position;
+	glm::vec4 normal;
+	glm::vec4 color;
+};
+
+// One side of a voxel: its outward normal and its corners in half steps from the voxel center
+struct VoxelFace
+{
+	int normal[3];
+	int corners[4][3];
+};
+
+constexpr VoxelFace voxelFaces[] = {
+	{{1, 0, 0}, {{1, -1, -1}, {1, 1, -1}, {1, 1, 1}, {1, -1, 1}}},
+	{{-1, 0, 0}, {{-1, -1, -1}, {-1, -1, 1}, {-1, 1, 1}, {-1, 1, -1}}},
+	{{0, 1, 0}, {{-1, 1, -1}, {-1, 1, 1}, {1, 1, 1}, {1, 1, -1}}},
+	{{0, -1, 0}, {{-1, -1, -1}, {1, -1, -1}, {1, -1, 1}, {-1, -1, 1}}},
+	{{0, 0, 1}, {{-1, -1, 1}, {1, -1, 1}, {1, 1, 1}, {-1, 1, 1}}},
+	{{0, 0, -1}, {{-1, -1, -1}, {-1, 1, -1}, {1, 1, -1}, {1, -1, -1}}},
+};
+
 constexpr std::string_view viewProjVertexShaderSource =
 	"#version 450 core\n"
 	"layout (location = 0) in vec3 position;\n"
@@ -511,6 +534,11 @@ constexpr std::string_view marchingCubeComputeShaderSource =
 	"    }\n"
 	"    for (uint i = 0; triTable[classification * 16 + i] != -1; i += 3) {\n"
 	"        uint index = atomicAdd(indirectData.count, 3);\n"
+	"        // The buffer only holds the budgeted amount of vertices: hand a triangle that doesn't fit back and drop it\n"
+	"        if (index + 3 > uint(vertices.length())) {\n"
+	"            atomicAdd(indirectData.count, uint(-3));\n"
+	"            break;\n"
+	"        }\n"
 	"        vertices[index].position = vertlist[triTable[classification * 16 + i]] + vec4(gl_GlobalInvocationID, 0);\n"
 	"        vertices[index + 1].position = vertlist[triTable[classification * 16 + i + 1]] + vec4(gl_GlobalInvocationID, 0);\n"
 	"        vertices[index + 2].position = vertlist[triTable[classification * 16 + i + 2]] + vec4(gl_GlobalInvocationID, 0);\n"
@@ -571,6 +599,7 @@ constexpr std::string_view voxelFragmentShaderSource =
 Renderer::Renderer(Scene3DRenderer &s3d)
 	: m_scene3d(s3d)
 	, m_arc_ball()
+	, m_subVolumeVertexCount(0)
 	, m_viewMatrix(1)
 	, m_projectionMatrix(1)
 {
@@ -912,17 +941,11 @@ void Renderer::initializeGeometry()
 
 	// Voxels using marching cubes via indirect calls through compute shader
 	{
-		struct vertex_t
-		{
-			glm::vec4 position;
-			glm::vec4 normal;
-			glm::vec4 color;
-		};
 		Buffer::CreateInfo buffer_info;
 
 		// Vertex Buffer
-		// 15 possible vertex per voxel
-		buffer_info.Size = sizeof(vertex_t) * 15 * m_scene3d.getReconstructor().getVoxelCount();
+		// 15 possible vertex per voxel, up to the mesh budget
+		buffer_info.Size = sizeof(vertex_t) * m_scene3d.getReconstructor().getConfig().getMeshVertexCapacity();
 		buffer_info.BufferType = Buffer::Type ::ShaderStorage;
 		buffer_info.BufferUsage = Buffer::Usage::DynamicDraw;
 		buffer_info.DebugName = "voxel vertex buffer";
@@ -1076,6 +1099,9 @@ void Renderer::keyboard(const SDL_KeyboardEvent& event)
 	case SDLK_e:
 		m_scene3d.calibThresholds();
 		break;
+	case SDLK_a:
+		m_scene3d.setTuneThresholds(!m_scene3d.isTuneThresholds());
+		break;
 	case SDLK_1:
 	case SDLK_2:
 	case SDLK_3:
@@ -1144,16 +1170,20 @@ void Renderer::display()
 	auto rot_z = glm::eulerAngleZ(glm::radians(m_arc_ball.get_z_rotation()));
 	m_viewMatrix = rot_z * zoom * matrix;
 
-	// Compute point cloud mesh
-	auto dim = m_scene3d.getReconstructor().getVoxelDimension();
-	m_marchingCubesPipeline->bind();
-	m_marchingCubesPipeline->setUniform("resolution", glm::vec3(dim[0], dim[1], dim[2]));
-	m_marchingCubesPipeline->setUniform("indirect_data", 0, *m_indirectBuffer);
-	m_marchingCubesPipeline->setUniform("edge_lut", 1, *m_marchingCubeEdgeLookUpBuffer);
-	m_marchingCubesPipeline->setUniform("triangle_lut", 2, *m_marchingCubeTriangleLookUpBuffer);
-	m_marchingCubesPipeline->setUniform("vertex_data", 3, m_voxelMesh->getVertexBuffer());
-	m_scalarField->bind();
-	m_renderer->dispatch(dim[0] / 8, dim[1] / 8, dim[2] / 8);
+	// Compute point cloud mesh, unless the refined persons fill the vertex buffer instead
+	const bool refined = m_subVolumeVertexCount > 0;
+	if (!refined)
+	{
+		auto dim = m_scene3d.getReconstructor().getVoxelDimension();
+		m_marchingCubesPipeline->bind();
+		m_marchingCubesPipeline->setUniform("resolution", glm::vec3(dim[0], dim[1], dim[2]));
+		m_marchingCubesPipeline->setUniform("indirect_data", 0, *m_indirectBuffer);
+		m_marchingCubesPipeline->setUniform("edge_lut", 1, *m_marchingCubeEdgeLookUpBuffer);
+		m_marchingCubesPipeline->setUniform("triangle_lut", 2, *m_marchingCubeTriangleLookUpBuffer);
+		m_marchingCubesPipeline->setUniform("vertex_data", 3, m_voxelMesh->getVertexBuffer());
+		m_scalarField->bind();
+		m_renderer->dispatch((dim[0] + 7) / 8, (dim[1] + 7) / 8, (dim[2] + 7) / 8);
+	}
 
 	m_renderPass->bind();
 
@@ -1179,13 +1209,25 @@ void Renderer::display()
 	m_voxelPipeline->bind();
 	m_voxelPipeline->setUniform("view", m_viewMatrix);
 	m_voxelPipeline->setUniform("proj", m_projectionMatrix);
-	m_voxelPipeline->setUniform("scale", (float)m_scene3d.getReconstructor().getVoxelSize());
-	m_voxelPipeline->setUniform("offset", glm::vec3(offset[0], offset[1], offset[2]));
+	if (refined)
+	{
+		// The sub-volume mesh is in world coordinates
+		m_voxelPipeline->setUniform("scale", 1.0f);
+		m_voxelPipeline->setUniform("offset", glm::vec3(0.0f, 0.0f, 0.0f));
+	}
+	else
+	{
+		m_voxelPipeline->setUniform("scale", (float)m_scene3d.getReconstructor().getVoxelSize());
+		m_voxelPipeline->setUniform("offset", glm::vec3(offset[0], offset[1], offset[2]));
+	}
 	auto camera = m_scene3d.getCameras()[std::clamp(m_scene3d.getCurrentCamera(), 0, (int)m_scene3d.getCameras().size() - 1)];
 	auto camera_location = camera.getCameraLocation();
 	m_voxelPipeline->setUniform("light_position", glm::vec3(camera_location.x, camera_location.y, camera_location.x));
 	m_voxelPipeline->setUniform("light_intensity", 40000000.0f);
-	m_voxelMesh->draw(*m_indirectBuffer);
+	if (refined)
+		m_voxelMesh->draw(m_subVolumeVertexCount);
+	else
+		m_voxelMesh->draw(*m_indirectBuffer);
 
 	m_overlayRenderPass->bind();
 	if (m_scene3d.isShowOrg())
@@ -1215,6 +1257,61 @@ void Renderer::display()
 	m_renderer->swapBuffers();
 }
 
+/**
+ * Fill the voxel vertex buffer with the exposed sides of the occupied voxels
+ * of the refined sub-volumes, in world coordinates and the color of their
+ * cluster. Sides beyond the mesh budget are dropped. Nothing refined leaves
+ * the buffer to the marching cubes of the coarse volume.
+ */
+void Renderer::updateSubVolumeMesh()
+{
+	const Reconstructor& reconstructor = m_scene3d.getReconstructor();
+	const std::vector<SubVolume>& volumes = reconstructor.getSubVolumes();
+	m_subVolumeVertexCount = 0;
+	if (volumes.empty())
+		return;
+
+	static constexpr int triangle_corners[] = { 0, 1, 2, 0, 2, 3 };
+	const size_t capacity = reconstructor.getConfig().getMeshVertexCapacity();
+	auto mem = m_voxelMesh->getVertexBuffer().map(Buffer::MemoryMapAccess::Write);
+	vertex_t* vertices = reinterpret_cast<vertex_t*>(mem.get());
+	std::vector<uint8_t> occupied;
+	for (const SubVolume& volume : volumes)
+	{
+		const VoxelGrid& grid = volume.grid;
+		occupied.assign(grid.size(), 0);
+		for (const uint32_t voxel : volume.voxels)
+			occupied[voxel] = 1;
+
+		const float half = grid.step * 0.5f;
+		for (const uint32_t voxel : volume.voxels)
+		{
+			const cv::Vec3i position = grid.position(voxel);
+			const cv::Point3i center = grid.coordinate(voxel);
+			for (const VoxelFace& face : voxelFaces)
+			{
+				// Only the sides facing an empty voxel are visible
+				const cv::Vec3i neighbor(position[0] + face.normal[0], position[1] + face.normal[1], position[2] + face.normal[2]);
+				if (neighbor[0] >= 0 && neighbor[1] >= 0 && neighbor[2] >= 0 && neighbor[0] < grid.dimension[0]
+						&& neighbor[1] < grid.dimension[1] && neighbor[2] < grid.dimension[2]
+						&& occupied[grid.index(neighbor[0], neighbor[1], neighbor[2])])
+					continue;
+				if (m_subVolumeVertexCount + 6 > capacity)
+					return;
+
+				for (const int corner : triangle_corners)
+				{
+					vertex_t& vertex = vertices[m_subVolumeVertexCount++];
+					vertex.position = glm::vec4(center.x + face.corners[corner][0] * half,
+							center.y + face.corners[corner][1] * half, center.z + face.corners[corner][2] * half, 1.0f);
+					vertex.normal = glm::vec4(face.normal[0], face.normal[1], face.normal[2], 0.0f);
+					vertex.color = volume.color;
+				}
+			}
+		}
+	}
+}
+
 /**
  * - Update the scene with a new frame from the video
  * - Handle the keyboard input from the OpenCV window
@@ -1253,6 +1350,7 @@ void Renderer::update()
 	{
 		// If the current frame is different from the last iteration update stuff
 		m_scene3d.processFrame();
+		updateSubVolumeMesh();
 		m_scene3d.setPreviousFrame(m_scene3d.getCurrentFrame());
 	}
 	else if (m_scene3d.getHThreshold() != m_scene3d.getPHThreshold() || m_scene3d.getSThreshold() != m_scene3d.getPSThreshold()
@@ -1260,6 +1358,7 @@ void Renderer::update()
 	{
 		// Update the scene if one of the HSV sliders was moved (when the video is paused)
 		m_scene3d.processFrame();
+		updateSubVolumeMesh();
 
 		m_scene3d.setPHThreshold(m_scene3d.getHThreshold());
 		m_scene3d.setPSThreshold(m_scene3d.getSThreshold());
@@ -1301,8 +1400,18 @@ void Renderer::update()
 	// Update the frame slider position
 	setTrackbarPos("Frame", VIDEO_WINDOW.data(), m_scene3d.getCurrentFrame());
 
+	// Only upload the bricks of the scalar field that changed, released bricks are cleared
+	static const std::vector<glm::vec4> empty_brick(BrickVolume::BRICK_VOXELS, glm::vec4(0.0f, 0.0f, 0.0f, 0.0f));
 	auto& scalarField = m_scene3d.getReconstructor().getScalarField();
-	m_scalarField->upload(scalarField.data(), scalarField.size() * sizeof(scalarField[0]));
+	scalarField.takeDirtyBricks(m_dirtyBricks);
+	for (const uint32_t brick : m_dirtyBricks)
+	{
+		const cv::Vec3i origin = scalarField.getBrickOrigin(brick);
+		const cv::Vec3i extent = scalarField.getBrickExtent(brick);
+		const BrickVolume::Brick* data = scalarField.getBrick(brick);
+		m_scalarField->uploadRegion(origin[0], origin[1], origin[2], extent[0], extent[1], extent[2],
+				data ? data->voxels : empty_brick.data(), BrickVolume::BRICK_SIZE, BrickVolume::BRICK_SIZE);
+	}
 }
 
 } /* namespace nl_uu_science_gmt */
@@ -9,6 +9,7 @@
 #define GLUT_H_
 
 #include <memory>
+#include <vector>
 
 #include "ArcBall.h"
 
@@ -45,6 +46,8 @@ public:
 	void quit();
 
 private:
+  void updateSubVolumeMesh();
+
   Scene3DRenderer &m_scene3d;
   ArcBall m_arc_ball;
   std::unique_ptr<Context> m_renderer;
@@ -65,7 +68,9 @@ private:
   std::unique_ptr<Buffer> m_marchingCubeEdgeLookUpBuffer;
   std::unique_ptr<Buffer> m_marchingCubeTriangleLookUpBuffer;
   std::unique_ptr<Texture> m_scalarField;
+  std::vector<uint32_t> m_dirtyBricks;
   std::unique_ptr<Mesh> m_voxelMesh;
+  uint32_t m_subVolumeVertexCount;  // Vertices of the refined sub-volumes in the voxel mesh, 0 draws the coarse volume
   glm::mat4 m_viewMatrix;
   glm::mat4 m_projectionMatrix;
 };
@@ -13,8 +13,13 @@
 #include <opencv2/imgproc/types_c.h>
 #include <opencv2/plot.hpp>
 #include <ClusterLabeler.h>
+#include <ForegroundKernel.h>
 #include <ForegroundOptimizer.h>
 #include <opencv2/ml/ml.hpp>
+#include <cassert>
+#include <chrono>
+#include <future>
+#include <tuple>
 #include "../utilities/General.h"
 
 
@@ -27,14 +32,39 @@ namespace nl_uu_science_gmt
 {
 	std::vector<std::vector<cv::Ptr<cv::ml::EM>>> ems;
 
+namespace
+{
+/**
+ * Color of person 'i' out of 'count': red, green, blue and black for the
+ * first four, hues spread evenly over the circle for any further ones
+ */
+glm::vec4 clusterColor(int i, int count)
+{
+	static const glm::vec4 primaries[] = {
+		glm::vec4(1.0f, 0.0f, 0.0f, 1.0f),
+		glm::vec4(0.0f, 1.0f, 0.0f, 1.0f),
+		glm::vec4(0.0f, 0.0f, 1.0f, 1.0f),
+		glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)
+	};
+	constexpr int PRIMARY_COUNT = 4;
+	if (i < PRIMARY_COUNT)
+		return primaries[i];
+
+	// Offset by half a step, so the extra hues fall between the primaries
+	Mat hsv(1, 1, CV_8UC3, Scalar((i - PRIMARY_COUNT + 0.5) * 180 / (count - PRIMARY_COUNT), 255, 255)), bgr;
+	cvtColor(hsv, bgr, COLOR_HSV2BGR);
+	const Vec3b color = bgr.at<Vec3b>(0, 0);
+	return glm::vec4(color[2] / 255.0f, color[1] / 255.0f, color[0] / 255.0f, 1.0f);
+}
+}
+
 /**
  * Constructor
  * Scene properties class (mostly called by Glut)
  */
 Scene3DRenderer::Scene3DRenderer(Reconstructor &r, vector<Camera> &cs)
 	:
-	  m_clusterLabeler(std::make_unique<ClusterLabeler>())
-	, m_foregroundOptimizer(std::make_unique<ForegroundOptimizer>(m_clusterLabeler->getNumClusters()))
+	  m_clusterLabeler(std::make_unique<ClusterLabeler>(r.getConfig()))
 	, m_reconstructor(r)
 	, m_cameras(cs)
 	, m_num(4)
@@ -69,13 +99,18 @@ Scene3DRenderer::Scene3DRenderer(Reconstructor &r, vector<Camera> &cs)
 	, m_v_threshold(48)
 	, m_pv_threshold(m_v_threshold)
 	, m_thresholdMaxNoise(15)
-	, m_cluster_traces{
-		std::vector<cv::Point2f>(m_number_of_frames),
-		std::vector<cv::Point2f>(m_number_of_frames),
-		std::vector<cv::Point2f>(m_number_of_frames),
-		std::vector<cv::Point2f>(m_number_of_frames),
-	}
+	, m_tune_thresholds(false)
+	, m_syncing_trackbars(false)
+	, m_cluster_traces(m_clusterLabeler->getNumClusters(), std::vector<cv::Point2f>(m_number_of_frames))
 {
+	for (int i = 0; i < m_clusterLabeler->getNumClusters(); ++i)
+		m_cluster_colors.push_back(clusterColor(i, m_clusterLabeler->getNumClusters()));
+	for (size_t c = 0; c < m_cameras.size(); ++c)
+	{
+		m_foregroundOptimizers.push_back(std::make_unique<ForegroundOptimizer>(m_clusterLabeler->getNumClusters()));
+		m_foregroundOptimizers.back()->setThresholds(m_h_threshold, m_s_threshold, m_v_threshold);
+	}
+	m_threshold_tuning.resize(m_cameras.size());
 	m_clusterLabeler->LoadEMS(m_cameras.front().getDataPath() / "..");
 
 	// Read the checkerboard properties (XML)
@@ -89,10 +124,10 @@ Scene3DRenderer::Scene3DRenderer(Reconstructor &r, vector<Camera> &cs)
 	}
 	fs.release();
 
-	//calibThresholds();
-
 	updateTrackbars();
 
+	calibThresholds();
+
 	createFloorGrid();
 	setTopView();
 }
@@ -102,48 +137,116 @@ void Scene3DRenderer::updateTrackbars()
 	createTrackbar("max noise", VIDEO_WINDOW.data(), &m_thresholdMaxNoise, 255);
 	createTrackbar("Frame", VIDEO_WINDOW.data(), &m_current_frame, m_number_of_frames - 2);
 
-	int h_threshold = m_h_threshold;
-	int s_threshold = m_s_threshold;
-	int v_threshold = m_v_threshold;
+	// The H, S and V trackbars edit the thresholds of the shown camera
+	createTrackbar("H", VIDEO_WINDOW.data(), nullptr, 255, onThresholdTrackbar, this);
+	createTrackbar("S", VIDEO_WINDOW.data(), nullptr, 255, onThresholdTrackbar, this);
+	createTrackbar("V", VIDEO_WINDOW.data(), nullptr, 255, onThresholdTrackbar, this);
 
-	createTrackbar("H", VIDEO_WINDOW.data(), &h_threshold, 255);
-	createTrackbar("S", VIDEO_WINDOW.data(), &s_threshold, 255);
-	createTrackbar("V", VIDEO_WINDOW.data(), &v_threshold, 255);
+	syncThresholdTrackbars();
+}
+
+/**
+ * Show the thresholds of the shown camera on the H, S and V trackbars, as
+ * the thresholds the current frame was processed with
+ */
+void Scene3DRenderer::syncThresholdTrackbars()
+{
+	const ForegroundOptimizer& optimizer = *m_foregroundOptimizers[getShownCamera()];
+	m_h_threshold = m_ph_threshold = optimizer.getHThreshold();
+	m_s_threshold = m_ps_threshold = optimizer.getSThreshold();
+	m_v_threshold = m_pv_threshold = optimizer.getVThreshold();
+
+	m_syncing_trackbars = true;
+	setTrackbarPos("H", VIDEO_WINDOW.data(), m_h_threshold);
+	setTrackbarPos("S", VIDEO_WINDOW.data(), m_s_threshold);
+	setTrackbarPos("V", VIDEO_WINDOW.data(), m_v_threshold);
+	m_syncing_trackbars = false;
+}
 
-	h_threshold = static_cast<uint8_t>(m_h_threshold);
-	s_threshold = static_cast<uint8_t>(m_s_threshold);
-	v_threshold = static_cast<uint8_t>(m_v_threshold);
+/**
+ * Give the shown camera the thresholds of the H, S and V trackbars, the
+ * renderer processes the frame again once they differ from the previous ones
+ */
+void Scene3DRenderer::onThresholdTrackbar(
+		int, void* data)
+{
+	Scene3DRenderer& scene = *static_cast<Scene3DRenderer*>(data);
+	if (scene.m_syncing_trackbars)
+		return;
+
+	scene.m_h_threshold = getTrackbarPos("H", VIDEO_WINDOW.data());
+	scene.m_s_threshold = getTrackbarPos("S", VIDEO_WINDOW.data());
+	scene.m_v_threshold = getTrackbarPos("V", VIDEO_WINDOW.data());
+	scene.m_foregroundOptimizers[scene.getShownCamera()]->setThresholds(scene.m_h_threshold, scene.m_s_threshold, scene.m_v_threshold);
 }
 
+/**
+ * Tune the S and V thresholds of every camera on its first video frame, each
+ * camera on its own thread. The captures are put back afterwards, so all
+ * cameras stay on the same frame.
+ */
 void Scene3DRenderer::calibThresholds()
 {
-	m_h_threshold = 0;
-	m_s_threshold = 255;
-	m_v_threshold = 255;
-
-	m_cameras[3].advanceVideoFrame();
-	assert(!m_cameras[3].getVideoFrame(0).empty());
-	Mat hsv_image;
-	cvtColor(m_cameras[3].getVideoFrame(0), hsv_image, CV_BGR2HSV);  // from BGR to HSV color space
-
-	std::vector<cv::Mat> channels;
-	cv::split(hsv_image, channels);  // Split the HSV-channels for further analysis
-
-	m_foregroundOptimizer->optimizeThresholds(
-		m_thresholdMaxNoise,
-		m_thresholdMaxNoise,
-		m_cameras[3].getBgHsvChannels().at(0),
-		m_cameras[3].getBgHsvChannels().at(1),
-		m_cameras[3].getBgHsvChannels().at(2),
-		channels,
-		m_h_threshold,
-		m_s_threshold,
-		m_v_threshold
-	);
-	updateTrackbars();
+	std::vector<std::future<void>> workers;
+	for (size_t c = 0; c < m_cameras.size(); ++c)
+	{
+		workers.push_back(std::async(std::launch::async, [this, c]
+		{
+			Camera& camera = m_cameras[c];
+			const Mat frame = camera.getVideoFrame(0).clone();
+			assert(!frame.empty());
+
+			// Restore the shown frame, the next read has to be the frame after it
+			if (m_previous_frame >= 0)
+				camera.getVideoFrame(m_previous_frame);
+			else
+				camera.setVideoFrame(0);
+
+			m_foregroundOptimizers[c]->calibrateThresholds(frame, camera.getBgHsvChannels(), m_thresholdMaxNoise);
+		}));
+	}
+	for (auto & worker : workers)
+		worker.get();
+
+	syncThresholdTrackbars();
+}
+
+
+/**
+ * Set the hue threshold of every camera
+ */
+void Scene3DRenderer::setHThreshold(
+		int threshold)
+{
+	m_h_threshold = threshold;
+	for (auto & optimizer : m_foregroundOptimizers)
+		optimizer->setThresholds(m_h_threshold, optimizer->getSThreshold(), optimizer->getVThreshold());
+	setTrackbarPos("H", VIDEO_WINDOW.data(), m_h_threshold);
+}
 
+/**
+ * Set the saturation threshold of every camera, replacing the tuned ones
+ */
+void Scene3DRenderer::setSThreshold(
+		int threshold)
+{
+	m_s_threshold = threshold;
+	for (auto & optimizer : m_foregroundOptimizers)
+		optimizer->setThresholds(optimizer->getHThreshold(), m_s_threshold, optimizer->getVThreshold());
+	setTrackbarPos("S", VIDEO_WINDOW.data(), m_s_threshold);
 }
 
+/**
+ * Set the value threshold of every camera, replacing the tuned ones
+ */
+void Scene3DRenderer::setVThreshold(
+		int threshold)
+{
+	m_v_threshold = threshold;
+	for (auto & optimizer : m_foregroundOptimizers)
+		optimizer->setThresholds(optimizer->getHThreshold(), optimizer->getSThreshold(), m_v_threshold);
+	setTrackbarPos("V", VIDEO_WINDOW.data(), m_v_threshold);
+}
 
 /**
  * Deconstructor
@@ -156,30 +259,44 @@ Scene3DRenderer::~Scene3DRenderer() = default;
  */
 bool Scene3DRenderer::processFrame()
 {
-	for (auto & camera : m_cameras)
+	// Every camera decodes and segments its frame on its own thread, with its own optimizer
+	std::vector<std::future<void>> workers;
+	for (size_t c = 0; c < m_cameras.size(); ++c)
 	{
-		if (m_current_frame == m_previous_frame + 1)
-		{
-			camera.advanceVideoFrame();
-		}
-		else if (m_current_frame != m_previous_frame)
+		workers.push_back(std::async(std::launch::async, [this, c]
 		{
-			camera.getVideoFrame(m_current_frame);
-		}
-		processForeground(camera);
+			Camera& camera = m_cameras[c];
+			if (m_current_frame == m_previous_frame + 1)
+			{
+				camera.advanceVideoFrame();
+			}
+			else if (m_current_frame != m_previous_frame)
+			{
+				camera.getVideoFrame(m_current_frame);
+			}
+			processForeground(camera, *m_foregroundOptimizers[c]);
+		}));
 	}
+	for (auto & worker : workers)
+		worker.get();
+
+	if (m_tune_thresholds)
+		updateThresholdTuning();
 
 	m_reconstructor.update();
 
-	constexpr uint8_t NUM_CONTOURS = 4;
+	const uint8_t NUM_CONTOURS = (uint8_t) m_clusterLabeler->getNumClusters();
 	constexpr uint8_t NUM_RETRIES = 10;
 
 	auto [centers, labels] = m_clusterLabeler->FindClusters(
 		NUM_CONTOURS,
 		NUM_RETRIES,
-		m_reconstructor.getVoxels(),
+		m_reconstructor.getVoxelGrid(),
 		m_reconstructor.getVisibleVoxelIndices());
 
+	// Carve the persons again on a finer grid, if configured
+	m_reconstructor.refine(labels, NUM_CONTOURS);
+
 	std::vector<std::vector<cv::Mat>> masks;
 	for (auto & camera : m_cameras)
 	{
@@ -187,7 +304,7 @@ bool Scene3DRenderer::processFrame()
 			NUM_CONTOURS,
 			camera,
 			m_reconstructor.getVoxelSize() * 0.5f,
-			m_reconstructor.getVoxels(),
+			m_reconstructor.getVoxelGrid(),
 			m_reconstructor.getVisibleVoxelIndices(),
 			labels));
 	}
@@ -195,46 +312,32 @@ bool Scene3DRenderer::processFrame()
 	m_clusterLabeler->CleanupMasks(masks);
 	vector<int> maskToEmNr = m_clusterLabeler->PredictEMS(m_cameras, masks);
 
-	// TODO: Change the order of the colors based on the color modeling
-	std::vector<glm::vec4> colors = {
-		glm::vec4(1.0f, 0.0f, 0.0f, 1.0f),
-		glm::vec4(0.0f, 1.0f, 0.0f, 1.0f),
-		glm::vec4(0.0f, 0.0f, 1.0f, 1.0f),
-		glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)
-	};
-
-	std::vector<glm::vec4> swizzled_colors(4);
-
-	for (int i = 0; i < 4; i++)
+	std::vector<glm::vec4> swizzled_colors(NUM_CONTOURS);
+	for (int i = 0; i < NUM_CONTOURS; i++)
 	{
-		swizzled_colors[i] = colors[maskToEmNr[i]];
+		swizzled_colors[i] = m_cluster_colors[maskToEmNr[i]];
 	}
-	
+
 	m_reconstructor.color(labels, swizzled_colors);
 
-	// TODO: Change the order of the centers based on the color modeling
-	m_cluster_traces[maskToEmNr[0]][m_current_frame] = reinterpret_cast<cv::Point2f*>(centers.data)[0] * 0.1;
-	m_cluster_traces[maskToEmNr[1]][m_current_frame] = reinterpret_cast<cv::Point2f*>(centers.data)[1] * 0.1;
-	m_cluster_traces[maskToEmNr[2]][m_current_frame] = reinterpret_cast<cv::Point2f*>(centers.data)[2] * 0.1;
-	m_cluster_traces[maskToEmNr[3]][m_current_frame] = reinterpret_cast<cv::Point2f*>(centers.data)[3] * 0.1;
-
-	m_cluster_traces[0][m_current_frame].x += 250;
-	m_cluster_traces[0][m_current_frame].y = 250 - m_cluster_traces[0][m_current_frame].y;
-	m_cluster_traces[1][m_current_frame].x += 250;
-	m_cluster_traces[1][m_current_frame].y = 250 - m_cluster_traces[1][m_current_frame].y;
-	m_cluster_traces[2][m_current_frame].x += 250;
-	m_cluster_traces[2][m_current_frame].y = 250 - m_cluster_traces[2][m_current_frame].y;
-	m_cluster_traces[3][m_current_frame].x += 250;
-	m_cluster_traces[3][m_current_frame].y = 250 - m_cluster_traces[3][m_current_frame].y;
+	// Floor positions in cm, around the center of the 500x500 trace image
+	for (int i = 0; i < NUM_CONTOURS; i++)
+	{
+		cv::Point2f& trace = m_cluster_traces[maskToEmNr[i]][m_current_frame];
+		trace = reinterpret_cast<cv::Point2f*>(centers.data)[i] * 0.1;
+		trace.x += 250;
+		trace.y = 250 - trace.y;
+	}
 
 	Mat display = Mat(cv::Size(500, 500), CV_8UC3, Scalar::all(255));
 
 	for (uint32_t i = 2; i < m_current_frame; ++i)
 	{
-		cv::line(display, m_cluster_traces[0][i - 1], m_cluster_traces[0][i], cv::Scalar(colors[0][2] * 255, colors[0][1] * 255, colors[0][0] * 255));
-		cv::line(display, m_cluster_traces[1][i - 1], m_cluster_traces[1][i], cv::Scalar(colors[1][2] * 255, colors[1][1] * 255, colors[1][0] * 255));
-		cv::line(display, m_cluster_traces[2][i - 1], m_cluster_traces[2][i], cv::Scalar(colors[2][2] * 255, colors[2][1] * 255, colors[2][0] * 255));
-		cv::line(display, m_cluster_traces[3][i - 1], m_cluster_traces[3][i], cv::Scalar(colors[3][2] * 255, colors[3][1] * 255, colors[3][0] * 255));
+		for (size_t c = 0; c < m_cluster_traces.size(); ++c)
+		{
+			const glm::vec4& color = m_cluster_colors[c];
+			cv::line(display, m_cluster_traces[c][i - 1], m_cluster_traces[c][i], cv::Scalar(color[2] * 255, color[1] * 255, color[0] * 255));
+		}
 	}
 
 	cv::imshow("path", display);
@@ -242,32 +345,66 @@ bool Scene3DRenderer::processFrame()
 	return true;
 }
 
+/**
+ * Retune the S and V thresholds of every camera in the background: apply the
+ * result of a camera's previous round once it is done, then start its next
+ * round on the current frame. Rounds work on copies, so they run on while
+ * the next frames are processed.
+ */
+void Scene3DRenderer::updateThresholdTuning()
+{
+	for (size_t c = 0; c < m_cameras.size(); ++c)
+	{
+		ForegroundOptimizer& optimizer = *m_foregroundOptimizers[c];
+		auto& tuning = m_threshold_tuning[c];
+		if (tuning.valid())
+		{
+			if (tuning.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+				continue;
+			const auto [s_threshold, v_threshold] = tuning.get();
+			optimizer.setThresholds(optimizer.getHThreshold(), s_threshold, v_threshold);
+			if ((int) c == getShownCamera())
+				syncThresholdTrackbars();
+		}
+
+		const Camera& camera = m_cameras[c];
+		std::vector<cv::Mat> background;
+		for (const auto& channel : camera.getBgHsvChannels())
+			background.push_back(channel.clone());
+
+		tuning = std::async(std::launch::async,
+			[frame = camera.getFrame().clone(), background = std::move(background), h_threshold = optimizer.getHThreshold(),
+				max_noise = m_thresholdMaxNoise, clusters = m_clusterLabeler->getNumClusters()]
+		{
+			ForegroundOptimizer tuner(clusters);
+			tuner.setThresholds(h_threshold, 255, 255);
+			tuner.calibrateThresholds(frame, background, max_noise);
+			return std::make_pair(tuner.getSThreshold(), tuner.getVThreshold());
+		});
+	}
+}
+
 /**
  * Separate the background from the foreground
  * ie.: Create an 8 bit image where only the foreground of the scene is white (255)
  */
-void Scene3DRenderer::processForeground(Camera& camera)
+void Scene3DRenderer::processForeground(Camera& camera, ForegroundOptimizer& optimizer)
 {
 	assert(!camera.getFrame().empty());
-	Mat hsv_image;
-	cvtColor(camera.getFrame(), hsv_image, CV_BGR2HSV);  // from BGR to HSV color space
-
-	std::vector<cv::Mat> channels;
-	cv::split(hsv_image, channels);  // Split the HSV-channels for further analysis
-
-	cv::Mat foreground = m_foregroundOptimizer->runHSVThresholding(
-		camera.getBgHsvChannels().at(0),
-		camera.getBgHsvChannels().at(1),
-		camera.getBgHsvChannels().at(2),
-		channels,
-		m_h_threshold,
-		m_s_threshold,
-		m_v_threshold
+
+	// HSV conversion and background subtraction in one pass over the frame
+	cv::Mat foreground;
+	ForegroundKernel::subtract(
+		camera.getFrame(),
+		camera.getBgHsvChannels(),
+		ForegroundKernel::Thresholds{ optimizer.getHThreshold(), optimizer.getSThreshold(), optimizer.getVThreshold() },
+		foreground
 	);
 
-	m_foregroundOptimizer->FindContours(foreground);
-	m_foregroundOptimizer->SaveMaxContours(1000, 100);
-	m_foregroundOptimizer->DrawMaxContours(foreground, true, 255);
+	optimizer.KeepMaxComponents(foreground, 1000, 100);
+
+	// Follow lighting changes in the pixels that stayed background
+	camera.updateBackground(foreground);
 
 	// Improve the foreground image
 	camera.setForegroundImage(foreground);
@@ -291,6 +428,7 @@ void Scene3DRenderer::setCamera(
 		m_arcball_up.x = 0.0f;
 		m_arcball_up.y = 0.0f;
 		m_arcball_up.z = 1.0f;
+		syncThresholdTrackbars();
 	}
 }
 
@@ -9,8 +9,12 @@
 #define SCENE3DRENDERER_H_
 
 #include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
 #include <opencv2/core/core.hpp>
 #include <opencv2/core/operations.hpp>
+#include <future>
+#include <memory>
+#include <utility>
 #include <vector>
 #ifdef _WIN32
 #include <Windows.h>
@@ -29,7 +33,7 @@ class ForegroundOptimizer;
 class Scene3DRenderer
 {
 	std::unique_ptr<ClusterLabeler>      m_clusterLabeler;
-	std::unique_ptr<ForegroundOptimizer> m_foregroundOptimizer;
+	std::vector<std::unique_ptr<ForegroundOptimizer>> m_foregroundOptimizers;  // One per camera, so cameras are processed concurrently
 	Reconstructor &m_reconstructor;          // Reference to Reconstructor
 	std::vector<Camera> &m_cameras;  // Reference to camera's vector
 	const int m_num;                        // Floor grid scale
@@ -69,20 +73,34 @@ class Scene3DRenderer
 	int m_current_camera;                     // number of currently selected camera view point
 	int m_previous_camera;                    // number of previously selected camera view point
 
-	uint8_t m_h_threshold;                    // Hue threshold number for background subtraction
+	uint8_t m_h_threshold;                    // Hue threshold number for background subtraction, of the shown camera
 	uint8_t m_ph_threshold;                   // Hue threshold value at previous iteration (update awareness)
-	uint8_t m_s_threshold;                    // Saturation threshold number for background subtraction
+	uint8_t m_s_threshold;                    // Saturation threshold number for background subtraction, of the shown camera
 	uint8_t m_ps_threshold;                   // Saturation threshold value at previous iteration (update awareness)
-	uint8_t m_v_threshold;                    // Value threshold number for background subtraction
+	uint8_t m_v_threshold;                    // Value threshold number for background subtraction, of the shown camera
 	uint8_t m_pv_threshold;                   // Value threshold value at previous iteration (update awareness)
 	int m_thresholdMaxNoise;		  // max increases in seperate blobs detected betweewn threshold operations until termination for V
+	bool m_tune_thresholds;                   // flag retune the S and V thresholds in the background during playback
+	bool m_syncing_trackbars;                 // flag the H, S and V trackbars are moved to the thresholds, not by the user
+	std::vector<std::future<std::pair<uint8_t, uint8_t>>> m_threshold_tuning;   // Per camera the running tuning round, yields its S and V thresholds
 
-	std::vector<cv::Point2f> m_cluster_traces[4];
+	std::vector<glm::vec4> m_cluster_colors;                   // Color of each person
+	std::vector<std::vector<cv::Point2f>> m_cluster_traces;    // Per person the floor position at each frame
 
 	// edge points of the virtual ground floor grid
 	std::vector<std::vector<cv::Point3i> > m_floor_grid;
 
 	void createFloorGrid();
+	void updateThresholdTuning();
+	void syncThresholdTrackbars();
+	static void onThresholdTrackbar(
+			int, void*);
+
+	// Camera shown in the video window, the previous one in the top view
+	int getShownCamera() const
+	{
+		return m_current_camera != -1 ? m_current_camera : m_previous_camera;
+	}
 
 #ifdef _WIN32
 	HDC _hDC;
@@ -98,7 +116,7 @@ public:
 	void updateTrackbars();
 
 	void processForeground(
-			Camera&);
+			Camera&, ForegroundOptimizer&);
 
 	bool processFrame();
 	void setCamera(
@@ -236,6 +254,17 @@ public:
 		m_paused = paused;
 	}
 
+	bool isTuneThresholds() const
+	{
+		return m_tune_thresholds;
+	}
+
+	void setTuneThresholds(
+			bool tune_thresholds)
+	{
+		m_tune_thresholds = tune_thresholds;
+	}
+
 	bool isRotate() const
 	{
 		return m_rotate;
@@ -404,22 +433,11 @@ public:
 	}
 
 	void setHThreshold(
-			int threshold)
-	{
-		m_h_threshold = threshold;
-	}
-
+			int);
 	void setSThreshold(
-			int threshold)
-	{
-		m_s_threshold = threshold;
-	}
-
+			int);
 	void setVThreshold(
-			int threshold)
-	{
-		m_v_threshold = threshold;
-	}
+			int);
 
 	const cv::Size& getBoardSize() const
 	{
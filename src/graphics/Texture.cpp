@@ -113,6 +113,7 @@ std::unique_ptr<Texture> Texture::create(const CreateInfo& info) {
                      format.type,
                      nullptr);
     }
+    glClearTexImage(handle, 0, format.format, format.type, nullptr);
 
     return std::unique_ptr<Texture>(new Texture(handle, target, info));
 }
@@ -165,3 +166,41 @@ void Texture::upload(const void* data, [[maybe_unused]] uint32_t size)
                         data);
     }
 }
+
+void Texture::uploadRegion(uint32_t x, uint32_t y, uint32_t z, uint32_t width, uint32_t height, uint32_t depth,
+                           const void* data, uint32_t row_length, uint32_t image_height)
+{
+    assert(x + width <= info_.Width && y + height <= info_.Height && z + depth <= info_.Depth);
+    auto format = TextureFormatLookUpTable[static_cast<uint32_t>(info_.DataFormat)];
+    bind();
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, row_length);
+    glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, image_height);
+    if (target_ == GL_TEXTURE_2D)
+    {
+        glTexSubImage2D(target_,
+                        0,
+                        x,
+                        y,
+                        width,
+                        height,
+                        format.format,
+                        format.type,
+                        data);
+    }
+    else if (target_ == GL_TEXTURE_3D)
+    {
+        glTexSubImage3D(target_,
+                        0,
+                        x,
+                        y,
+                        z,
+                        width,
+                        height,
+                        depth,
+                        format.format,
+                        format.type,
+                        data);
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, 0);
+}
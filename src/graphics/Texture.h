@@ -10,6 +10,7 @@ class Mat;
 }
 
 /// Wrapper around OpenGL textures, OpenCV-OpenGL interop and samplers
+/// Textures start out zeroed.
 /// Allows upload of data but not resizing or modifying texture attributes
 /// once they are created. These are expensive operations which are not
 /// desired.
@@ -85,6 +86,12 @@ public:
 
     void upload(const void* data, uint32_t size);
 
+    /// Upload the box [x, x + width) x [y, y + height) x [z, z + depth) of
+    /// the texture. Rows of the source data are row_length texels apart and
+    /// layers row_length * image_height texels, 0 means tightly packed.
+    void uploadRegion(uint32_t x, uint32_t y, uint32_t z, uint32_t width, uint32_t height, uint32_t depth,
+                      const void* data, uint32_t row_length = 0, uint32_t image_height = 0);
+
 private:
     /// Private unique constructor forcing the use of factory function which
     /// can return null unlike constructor.
@@ -1,7 +1,10 @@
 #include <cstdlib>
 #include <filesystem>
+#include <iostream>
 
+#include <ReconstructionConfig.h>
 #include "VoxelReconstruction.h"
+#include "utilities/General.h"
 
 using namespace nl_uu_science_gmt;
 
@@ -9,7 +12,15 @@ int main(
 		int argc, char** argv)
 {
 	VoxelReconstruction::showKeys();
-	VoxelReconstruction vr(std::filesystem::path("data"), 4);
+
+	const std::filesystem::path data_path("data");
+	// The viewer shows a preview while the LUT is built, unless the config file says otherwise
+	ReconstructionConfig config;
+	config.lazy_lut = true;
+	if (config.load(data_path / General::ReconstructionConfigFile))
+		std::cout << "Using " << data_path / General::ReconstructionConfigFile << std::endl;
+
+	VoxelReconstruction vr(data_path, config);
 	vr.run(argc, argv);
 
 	return EXIT_SUCCESS;
@@ -26,6 +26,7 @@ constexpr std::string_view VideoFile = "video.avi";
 constexpr std::string_view IntrinsicsFile = "intrinsics.xml";
 constexpr std::string_view CheckerboadCorners = "boardcorners.xml";
 constexpr std::string_view ConfigFile = "config.xml";
+constexpr std::string_view ReconstructionConfigFile = "reconstruction.xml";
 }
 
 } /* namespace nl_uu_science_gmt */